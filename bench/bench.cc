@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <print>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "byte_buffer.h"
+#include "codec.h"
+#include "synthetic.h"
+
+// Decode throughput of every block codec the unpacker handles, over the
+// block sizes Unity produces. Output is CSV on stdout so runs can be
+// diffed or plotted; progress and errors go to stderr.
+
+namespace {
+
+struct Codec {
+  std::string_view name;
+  CompressionType type;
+  GameMode mode;
+};
+
+constexpr Codec CODECS[] = {
+    {"none", CompressionType::None, GameMode::Standard},
+    {"lzma", CompressionType::Lzma, GameMode::Standard},
+    {"lz4", CompressionType::Lz4, GameMode::Standard},
+    {"lz4hc", CompressionType::Lz4hc, GameMode::Standard},
+    {"lzham", CompressionType::Lzham, GameMode::Standard},
+    {"lz4ak", CompressionType::Lzham, GameMode::Arknights},
+};
+
+constexpr size_t BLOCK_SIZES[] = {4 << 10,   16 << 10,  64 << 10,
+                                  128 << 10, 512 << 10, 2 << 20};
+
+struct Result {
+  size_t iterations;
+  double seconds;
+};
+
+template <typename Fn> Result time_until(double min_seconds, Fn &&fn) {
+  using clock = std::chrono::steady_clock;
+  fn(); // warm up per-thread decoder state
+  Result r{0, 0};
+  auto start = clock::now();
+  do {
+    fn();
+    ++r.iterations;
+    r.seconds = std::chrono::duration<double>(clock::now() - start).count();
+  } while (r.seconds < min_seconds);
+  return r;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  double min_time = 0.5;
+  uint64_t seed = 1;
+  std::vector<std::string_view> only;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg == "--min-time" && i + 1 < argc) {
+      min_time = std::stod(argv[++i]);
+    } else if (arg == "--seed" && i + 1 < argc) {
+      seed = std::stoull(argv[++i]);
+    } else if (arg == "--codec" && i + 1 < argc) {
+      only.emplace_back(argv[++i]);
+    } else {
+      std::println(stderr,
+                   "Usage: bench [--min-time SECONDS] [--seed N] "
+                   "[--codec none|lzma|lz4|lz4hc|lzham|lz4ak]...");
+      return 1;
+    }
+  }
+
+  std::println("codec,block_size,ratio,iterations,mb_per_s,ns_per_block");
+  int failures = 0;
+  for (const Codec &codec : CODECS) {
+    if (!only.empty() && std::ranges::find(only, codec.name) == only.end())
+      continue;
+    for (size_t block_size : BLOCK_SIZES) {
+      try {
+        auto input = make_synthetic_data(block_size, seed);
+        ByteBuffer packed = compress_block(codec.type, input, codec.mode);
+        ByteBuffer output(block_size);
+
+        size_t produced =
+            decompress_block_into(codec.type, packed, output, codec.mode);
+        if (produced != block_size ||
+            std::memcmp(output.data(), input.data(), block_size) != 0)
+          throw std::runtime_error("round trip mismatch");
+
+        Result r = time_until(min_time, [&] {
+          decompress_block_into(codec.type, packed, output, codec.mode);
+        });
+        double mb_per_s =
+            static_cast<double>(block_size) * r.iterations / r.seconds / 1e6;
+        double ns_per_block = r.seconds * 1e9 / r.iterations;
+        std::println("{},{},{:.4f},{},{:.1f},{:.0f}", codec.name, block_size,
+                     static_cast<double>(packed.size()) / block_size,
+                     r.iterations, mb_per_s, ns_per_block);
+      } catch (const std::exception &e) {
+        std::println(stderr, "{} @ {}: {}", codec.name, block_size, e.what());
+        ++failures;
+      }
+    }
+  }
+  return failures == 0 ? 0 : 1;
+}
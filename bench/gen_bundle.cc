@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <cstdint>
+#include <format>
+#include <fstream>
+#include <print>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bundle.h"
+#include "byte_buffer.h"
+#include "codec.h"
+#include "parallel.h"
+#include "process.h"
+#include "synthetic.h"
+
+// Writes synthetic UnityFS bundles for benchmarks and load tests. The same
+// options and seed always produce the same file, so a corpus can be rebuilt
+// on any machine instead of being shipped around.
+
+namespace {
+
+struct GenOptions {
+  uint64_t seed = 1;
+  size_t blocks = 16;
+  uint64_t min_block_size = 128 << 10;
+  uint64_t max_block_size = 128 << 10;
+  // Cycled across blocks, so "lzma,lz4" alternates the two.
+  std::vector<CompressionType> codecs{CompressionType::Lz4hc};
+  CompressionType info_codec = CompressionType::Lz4hc;
+  GameMode mode = GameMode::Standard;
+  size_t nodes = 1;
+  uint32_t version = 7;
+  std::string unity_ver = "2019.4.40f1";
+  std::string unity_rev = "5.x.x";
+  bool align_block_info = false;
+  bool info_at_end = false;
+  int level = -1;
+  unsigned threads = 0;
+};
+
+CompressionType parse_codec(std::string_view name) {
+  if (name == "none")
+    return CompressionType::None;
+  if (name == "lzma")
+    return CompressionType::Lzma;
+  if (name == "lz4")
+    return CompressionType::Lz4;
+  if (name == "lz4hc")
+    return CompressionType::Lz4hc;
+  if (name == "lzham" || name == "lz4ak")
+    return CompressionType::Lzham;
+  throw std::runtime_error(std::format("Unknown codec: {}", name));
+}
+
+// LZ4AK occupies the LZHAM slot, so a bundle can use one or the other but
+// not both; using LZ4AK switches the whole bundle to Arknights mode.
+std::vector<CompressionType> parse_codec_list(std::string_view list,
+                                              GameMode &mode) {
+  std::vector<CompressionType> codecs;
+  bool lzham = false;
+  bool lz4ak = false;
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t end = std::min(list.find(',', start), list.size());
+    std::string_view name = list.substr(start, end - start);
+    lzham |= name == "lzham";
+    lz4ak |= name == "lz4ak";
+    codecs.push_back(parse_codec(name));
+    start = end + 1;
+  }
+  if (lzham && lz4ak)
+    throw std::runtime_error("lzham and lz4ak cannot share a bundle");
+  mode = lz4ak ? GameMode::Arknights : GameMode::Standard;
+  return codecs;
+}
+
+struct GeneratedBlock {
+  ArchiveBlockInfo info;
+  ByteBuffer payload;
+};
+
+void generate(const std::string &output_path, const GenOptions &options) {
+  // mt19937_64's output is fixed by the standard but the distributions'
+  // are not, so sizes come straight from the engine to keep the corpus the
+  // same across standard libraries. The modulo bias is irrelevant here.
+  std::mt19937_64 rng(options.seed);
+  uint64_t size_range = options.max_block_size - options.min_block_size + 1;
+
+  std::vector<uint64_t> sizes(options.blocks);
+  uint64_t total = 0;
+  for (auto &size : sizes) {
+    size = options.min_block_size + rng() % size_range;
+    total += size;
+  }
+
+  // Each block gets its own content seed so blocks can be built in
+  // parallel without changing the output.
+  std::vector<GeneratedBlock> blocks(options.blocks);
+  parallel_for(options.blocks, options.threads, [&](size_t i) {
+    CompressionType type = options.codecs[i % options.codecs.size()];
+    auto data = make_synthetic_data(
+        sizes[i], options.seed ^ (0x9E3779B97F4A7C15 * (i + 1)));
+    ByteBuffer payload =
+        compress_block(type, data, options.mode, options.level);
+    blocks[i].info = {static_cast<uint32_t>(sizes[i]),
+                      static_cast<uint32_t>(payload.size()),
+                      static_cast<uint16_t>(type)};
+    blocks[i].payload = std::move(payload);
+  });
+
+  std::vector<ArchiveNode> nodes(options.nodes);
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    uint64_t begin = total * i / nodes.size();
+    uint64_t end = total * (i + 1) / nodes.size();
+    nodes[i] = {begin, end - begin, 4, std::format("CAB-{:016x}", rng())};
+  }
+
+  std::vector<ArchiveBlockInfo> infos;
+  uint64_t data_size = 0;
+  for (const auto &b : blocks) {
+    infos.push_back(b.info);
+    data_size += b.payload.size();
+  }
+
+  auto raw_info = build_block_info(infos, nodes);
+  ByteBuffer packed_info = compress_block(options.info_codec, raw_info,
+                                          GameMode::Standard, options.level);
+
+  BundleHeader header;
+  header.version = options.version;
+  header.unity_ver = options.unity_ver;
+  header.unity_rev = options.unity_rev;
+  header.compressed_blocks_info_size =
+      static_cast<uint32_t>(packed_info.size());
+  header.uncompressed_blocks_info_size =
+      static_cast<uint32_t>(raw_info.size());
+  header.flags = static_cast<uint32_t>(options.info_codec) |
+                 FLAG_BLOCKS_AND_DIR_COMBINED;
+  if (options.align_block_info)
+    header.flags |= FLAG_BLOCK_INFO_NEEDS_ALIGNMENT;
+  if (options.info_at_end)
+    header.flags |= FLAG_BLOCK_INFO_AT_END;
+
+  size_t data_start = bundle_header_size(options.version, options.unity_ver,
+                                         options.unity_rev);
+  if (!options.info_at_end)
+    data_start += packed_info.size();
+  size_t padding = 0;
+  if (options.align_block_info)
+    padding = (16 - data_start % 16) % 16;
+  header.bundle_size = static_cast<int64_t>(data_start + padding + data_size +
+                                            (options.info_at_end
+                                                 ? packed_info.size()
+                                                 : 0));
+
+  std::vector<uint8_t> prefix;
+  BinaryWriter writer(prefix);
+  write_bundle_header(writer, header);
+  if (!options.info_at_end)
+    writer.write_bytes(packed_info.data(), packed_info.size());
+  prefix.insert(prefix.end(), padding, 0);
+
+  std::ofstream ofs(output_path, std::ios::binary);
+  if (!ofs)
+    throw std::runtime_error(std::format("Cannot open {}", output_path));
+  ofs.write(reinterpret_cast<const char *>(prefix.data()), prefix.size());
+  for (const auto &b : blocks)
+    ofs.write(reinterpret_cast<const char *>(b.payload.data()),
+              b.payload.size());
+  if (options.info_at_end)
+    ofs.write(reinterpret_cast<const char *>(packed_info.data()),
+              packed_info.size());
+  if (!ofs.flush())
+    throw std::runtime_error(std::format("Failed writing {}", output_path));
+
+  std::println("{}: {} blocks, {} nodes, {} bytes ({} uncompressed)",
+               output_path, blocks.size(), nodes.size(), header.bundle_size,
+               total);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::println(
+        stderr,
+        "Usage: gen-bundle [--seed N] [--blocks N] [--block-size MIN[:MAX]]\n"
+        "                  [--codec none|lzma|lz4|lz4hc|lzham|lz4ak[,...]]\n"
+        "                  [--info-codec none|lzma|lz4|lz4hc|lzham] "
+        "[--nodes N]\n"
+        "                  [--version N] [--align] [--info-at-end] [--level N]\n"
+        "                  [--threads N] <output.ab>");
+    return 1;
+  }
+
+  try {
+    GenOptions options;
+    std::string output_path;
+
+    for (int arg_idx = 1; arg_idx < argc; ++arg_idx) {
+      std::string arg = argv[arg_idx];
+      auto value = [&]() -> std::string {
+        if (argc <= arg_idx + 1)
+          throw std::runtime_error(std::format("Missing value for {}", arg));
+        return argv[++arg_idx];
+      };
+
+      if (arg == "--seed") {
+        options.seed = std::stoull(value());
+      } else if (arg == "--blocks") {
+        options.blocks = std::stoull(value());
+      } else if (arg == "--block-size") {
+        std::string v = value();
+        size_t colon = v.find(':');
+        options.min_block_size = parse_byte_size(v.substr(0, colon));
+        options.max_block_size =
+            colon == std::string::npos ? options.min_block_size
+                                       : parse_byte_size(v.substr(colon + 1));
+      } else if (arg == "--codec") {
+        options.codecs = parse_codec_list(value(), options.mode);
+      } else if (arg == "--info-codec") {
+        std::string v = value();
+        if (v == "lz4ak")
+          throw std::runtime_error("Block info cannot use lz4ak");
+        options.info_codec = parse_codec(v);
+      } else if (arg == "--nodes") {
+        options.nodes = std::stoull(value());
+      } else if (arg == "--version") {
+        options.version = static_cast<uint32_t>(std::stoul(value()));
+      } else if (arg == "--align") {
+        options.align_block_info = true;
+      } else if (arg == "--info-at-end") {
+        options.info_at_end = true;
+      } else if (arg == "--level") {
+        options.level = std::stoi(value());
+      } else if (arg == "--threads") {
+        options.threads = static_cast<unsigned>(std::stoul(value()));
+      } else if (output_path.empty()) {
+        output_path = arg;
+      } else {
+        throw std::runtime_error(std::format("Unexpected argument: {}", arg));
+      }
+    }
+
+    if (output_path.empty())
+      throw std::runtime_error("Missing output file");
+    if (options.min_block_size == 0 ||
+        options.min_block_size > options.max_block_size ||
+        options.max_block_size > UINT32_MAX)
+      throw std::runtime_error("Invalid block size range");
+    if (options.nodes == 0)
+      throw std::runtime_error("A bundle needs at least one node");
+
+    generate(output_path, options);
+  } catch (const std::exception &e) {
+    std::println(stderr, "Error: {}", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Asset-like data: runs of repeated earlier content mixed with short bursts
+// of noise, so every codec finds matches at a range of distances without
+// the block collapsing to nothing. The same seed always gives the same
+// bytes.
+inline std::vector<uint8_t> make_synthetic_data(size_t size, uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  std::vector<uint8_t> data;
+  data.reserve(size);
+  while (data.size() < size) {
+    size_t run = 8 + rng() % 120;
+    if (data.size() > 64 && rng() % 4 != 0) {
+      size_t from = rng() % (data.size() - 32);
+      for (size_t i = 0; i < run && data.size() < size; ++i)
+        data.push_back(data[from + i % (data.size() - from)]);
+    } else {
+      for (size_t i = 0; i < run && data.size() < size; ++i)
+        data.push_back(static_cast<uint8_t>(rng() & 0x3F));
+    }
+  }
+  return data;
+}
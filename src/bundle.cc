@@ -0,0 +1,177 @@
+#include "bundle.h"
+
+std::vector<uint8_t>
+build_block_info(const std::vector<ArchiveBlockInfo> &blocks,
+                 const std::vector<ArchiveNode> &nodes) {
+  std::vector<uint8_t> blob;
+  BinaryWriter writer(blob);
+
+  uint8_t null_hash[16] = {0};
+  writer.write_bytes(null_hash, 16);
+
+  writer.write_be<uint32_t>(static_cast<uint32_t>(blocks.size()));
+  for (const auto &b : blocks) {
+    writer.write_be<uint32_t>(b.uncompressed_size);
+    writer.write_be<uint32_t>(b.compressed_size);
+    writer.write_be<uint16_t>(b.flags);
+  }
+
+  writer.write_be<uint32_t>(static_cast<uint32_t>(nodes.size()));
+  for (const auto &n : nodes) {
+    writer.write_be<int64_t>(n.offset);
+    writer.write_be<int64_t>(n.size);
+    writer.write_be<uint32_t>(n.status);
+    writer.write_string(n.path);
+  }
+  return blob;
+}
+
+std::vector<uint8_t> build_header(uint32_t version,
+                                  const std::string &unity_ver,
+                                  const std::string &unity_rev,
+                                  uint32_t flags, size_t block_info_size,
+                                  uint64_t data_size) {
+  BundleHeader h;
+  h.version = version;
+  h.unity_ver = unity_ver;
+  h.unity_rev = unity_rev;
+  h.bundle_size = static_cast<int64_t>(
+      bundle_header_size(version, unity_ver, unity_rev) + block_info_size +
+      data_size);
+  h.compressed_blocks_info_size = static_cast<uint32_t>(block_info_size);
+  h.uncompressed_blocks_info_size = static_cast<uint32_t>(block_info_size);
+  h.flags = flags;
+
+  std::vector<uint8_t> header;
+  BinaryWriter writer(header);
+  write_bundle_header(writer, h);
+  return header;
+}
+
+uint64_t block_info_offset(const BundleHeader &header) {
+  if (!(header.flags & FLAG_BLOCK_INFO_AT_END))
+    return header.end_offset;
+  if (header.bundle_size < 0 ||
+      static_cast<uint64_t>(header.bundle_size) <
+          header.end_offset + uint64_t{header.compressed_blocks_info_size})
+    throw std::out_of_range(std::format(
+        "bundle size {} cannot hold {} bytes of block info at its end",
+        header.bundle_size, header.compressed_blocks_info_size));
+  return static_cast<uint64_t>(header.bundle_size) -
+         header.compressed_blocks_info_size;
+}
+
+uint64_t data_offset(const BundleHeader &header) {
+  uint64_t offset = header.end_offset;
+  if (!(header.flags & FLAG_BLOCK_INFO_AT_END))
+    offset += header.compressed_blocks_info_size;
+  if (header.flags & FLAG_BLOCK_INFO_NEEDS_ALIGNMENT)
+    offset = (offset + 15) / 16 * 16;
+  return offset;
+}
+
+size_t bundle_header_size(uint32_t version, const std::string &unity_ver,
+                          const std::string &unity_rev) {
+  size_t size = sizeof("UnityFS") + 4 + unity_ver.size() + 1 +
+                unity_rev.size() + 1 + 8 + 4 + 4 + 4;
+  if (version >= 7)
+    size = (size + 15) / 16 * 16;
+  return size;
+}
+
+void write_bundle_header(BinaryWriter &writer, const BundleHeader &header) {
+  writer.write_string("UnityFS");
+  writer.write_be<uint32_t>(header.version);
+  writer.write_string(header.unity_ver);
+  writer.write_string(header.unity_rev);
+
+  writer.write_be<int64_t>(header.bundle_size);
+  writer.write_be<uint32_t>(header.compressed_blocks_info_size);
+  writer.write_be<uint32_t>(header.uncompressed_blocks_info_size);
+  writer.write_be<uint32_t>(header.flags);
+
+  if (header.version >= 7)
+    writer.align(16);
+}
+
+BundleHeader read_bundle_header(BinaryReader &reader) {
+  BundleHeader h;
+  std::string signature = reader.read_string();
+  h.version = reader.read_be<uint32_t>();
+  h.unity_ver = reader.read_string();
+  h.unity_rev = reader.read_string();
+
+  if (signature != "UnityFS") {
+    throw std::runtime_error("Only UnityFS format supported");
+  }
+
+  h.bundle_size = reader.read_be<int64_t>();
+  h.compressed_blocks_info_size = reader.read_be<uint32_t>();
+  h.uncompressed_blocks_info_size = reader.read_be<uint32_t>();
+  h.flags = reader.read_be<uint32_t>();
+
+  if (h.version >= 7)
+    reader.align(16);
+  h.end_offset = reader.tell();
+  return h;
+}
+
+BundleDirectory read_bundle_directory(const BundleHeader &header,
+                                      std::span<const uint8_t> raw_block_info) {
+  CompressionType header_comp =
+      static_cast<CompressionType>(header.flags & FLAG_COMPRESSION_MASK);
+
+  auto block_info_data = decompress_block(
+      header_comp, raw_block_info, header.uncompressed_blocks_info_size,
+      GameMode::Standard);
+
+  BinaryReader bi_reader(block_info_data);
+
+  bi_reader.get_span(16);
+
+  BundleDirectory dir;
+  uint32_t blocks_count = bi_reader.read_be<uint32_t>();
+  dir.blocks.resize(blocks_count);
+  for (auto &b : dir.blocks) {
+    b.uncompressed_size = bi_reader.read_be<uint32_t>();
+    b.compressed_size = bi_reader.read_be<uint32_t>();
+    b.flags = bi_reader.read_be<uint16_t>();
+  }
+
+  uint32_t nodes_count = bi_reader.read_be<uint32_t>();
+  dir.nodes.resize(nodes_count);
+  for (auto &n : dir.nodes) {
+    n.offset = bi_reader.read_be<int64_t>();
+    n.size = bi_reader.read_be<int64_t>();
+    n.status = bi_reader.read_be<uint32_t>();
+    n.path = bi_reader.read_string();
+  }
+  return dir;
+}
+
+StoredLayout plan_stored_layout(const std::vector<ArchiveBlockInfo> &blocks) {
+  StoredLayout layout;
+  layout.blocks.resize(blocks.size());
+  layout.slot_offsets.resize(blocks.size());
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    uint32_t slot_size = blocks[i].get_compression() == CompressionType::None
+                             ? blocks[i].compressed_size
+                             : blocks[i].uncompressed_size;
+    layout.blocks[i] = {slot_size, slot_size, 0};
+    layout.slot_offsets[i] = layout.data_size;
+    layout.data_size += slot_size;
+  }
+  return layout;
+}
+
+std::vector<uint8_t> build_stored_prefix(const BundleHeader &header,
+                                         const StoredLayout &layout,
+                                         const std::vector<ArchiveNode> &nodes) {
+  auto new_block_info_blob = build_block_info(layout.blocks, nodes);
+  auto prefix = build_header(header.version, header.unity_ver,
+                             header.unity_rev, FLAG_BLOCKS_AND_DIR_COMBINED,
+                             new_block_info_blob.size(), layout.data_size);
+  prefix.insert(prefix.end(), new_block_info_blob.begin(),
+                new_block_info_blob.end());
+  return prefix;
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "codec.h"
+
+constexpr uint32_t FLAG_COMPRESSION_MASK = 0x3F;
+constexpr uint32_t FLAG_BLOCKS_AND_DIR_COMBINED = 0x40;
+constexpr uint32_t FLAG_BLOCK_INFO_AT_END = 0x80;
+constexpr uint32_t FLAG_BLOCK_INFO_NEEDS_ALIGNMENT = 0b1000000000;
+
+// Per-block flag set on the fixed-size blocks of chunk-based bundles.
+constexpr uint16_t BLOCK_FLAG_STREAMED = 0x40;
+
+template <typename T> T swap_endian(T u) {
+  if constexpr (sizeof(T) == 1)
+    return u;
+  union {
+    T u;
+    unsigned char u8[sizeof(T)];
+  } source, dest;
+  source.u = u;
+  for (size_t k = 0; k < sizeof(T); k++)
+    dest.u8[k] = source.u8[sizeof(T) - k - 1];
+  return dest.u;
+}
+
+class BinaryReader {
+  std::span<const uint8_t> data_;
+  size_t pos_ = 0;
+
+public:
+  explicit BinaryReader(std::span<const uint8_t> data) : data_(data) {}
+
+  template <typename T> T read_be() {
+    if (pos_ + sizeof(T) > data_.size())
+      throw std::out_of_range("buffer overflow");
+    T val;
+    std::memcpy(&val, &data_[pos_], sizeof(T));
+    pos_ += sizeof(T);
+    return swap_endian(val);
+  }
+
+  std::string read_string() {
+    std::string s;
+    while (pos_ < data_.size() && data_[pos_] != 0) {
+      s += static_cast<char>(data_[pos_++]);
+    }
+    pos_++;
+    return s;
+  }
+
+  std::vector<uint8_t> read_bytes(size_t n) {
+    if (pos_ + n > data_.size())
+      throw std::out_of_range(std::format(
+          "buffer overflow: pos {} + n {} > size {}", pos_, n, data_.size()));
+    std::vector<uint8_t> d(data_.begin() + pos_, data_.begin() + pos_ + n);
+    pos_ += n;
+    return d;
+  }
+
+  std::span<const uint8_t> get_span(size_t n) {
+    if (pos_ + n > data_.size())
+      throw std::out_of_range(std::format(
+          "buffer overflow: pos {} + n {} > size {}", pos_, n, data_.size()));
+    auto s = std::span<const uint8_t>(data_.data() + pos_, n);
+    pos_ += n;
+    return s;
+  }
+
+  void seek(size_t p) { pos_ = p; }
+  size_t tell() const { return pos_; }
+  void align(size_t alignment) {
+    while (pos_ % alignment != 0)
+      pos_++;
+  }
+};
+
+class BinaryWriter {
+  std::vector<uint8_t> &buf_;
+
+public:
+  explicit BinaryWriter(std::vector<uint8_t> &buf) : buf_(buf) {}
+
+  template <typename T> void write_be(T val) {
+    T swapped = swap_endian(val);
+    write_bytes(&swapped, sizeof(T));
+  }
+
+  void write_bytes(const void *data, size_t size) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    buf_.insert(buf_.end(), p, p + size);
+  }
+
+  void write_string(const std::string &s) {
+    write_bytes(s.c_str(), s.size() + 1);
+  }
+
+  void align(size_t alignment) {
+    size_t pad = (alignment - (buf_.size() % alignment)) % alignment;
+    buf_.insert(buf_.end(), pad, 0);
+  }
+
+  size_t tell() { return buf_.size(); }
+};
+
+struct ArchiveBlockInfo {
+  uint32_t uncompressed_size;
+  uint32_t compressed_size;
+  uint16_t flags;
+
+  [[nodiscard]] CompressionType get_compression() const {
+    return static_cast<CompressionType>(flags & FLAG_COMPRESSION_MASK);
+  }
+};
+
+struct ArchiveNode {
+  uint64_t offset;
+  uint64_t size;
+  uint32_t status;
+  std::string path;
+};
+
+std::vector<uint8_t>
+build_block_info(const std::vector<ArchiveBlockInfo> &blocks,
+                 const std::vector<ArchiveNode> &nodes);
+
+// Builds the UnityFS header for a bundle whose uncompressed block info
+// immediately follows it. The result is padded the way the reader expects,
+// so the block info starts at `result.size()`.
+std::vector<uint8_t> build_header(uint32_t version,
+                                  const std::string &unity_ver,
+                                  const std::string &unity_rev,
+                                  uint32_t flags, size_t block_info_size,
+                                  uint64_t data_size);
+
+struct BundleHeader {
+  uint32_t version = 0;
+  std::string unity_ver;
+  std::string unity_rev;
+  int64_t bundle_size = 0;
+  uint32_t compressed_blocks_info_size = 0;
+  uint32_t uncompressed_blocks_info_size = 0;
+  uint32_t flags = 0;
+  // Offset just past the header, including the v7+ padding.
+  size_t end_offset = 0;
+};
+
+BundleHeader read_bundle_header(BinaryReader &reader);
+
+// Where the compressed block info starts: right after the header, or in
+// the last compressed_blocks_info_size bytes of the bundle when
+// FLAG_BLOCK_INFO_AT_END is set.
+uint64_t block_info_offset(const BundleHeader &header);
+
+// Where the first data block starts, for either block info placement.
+uint64_t data_offset(const BundleHeader &header);
+
+// Size of the serialised header, including the v7+ padding.
+size_t bundle_header_size(uint32_t version, const std::string &unity_ver,
+                          const std::string &unity_rev);
+
+// Inverse of read_bundle_header; `end_offset` is ignored. The writer is
+// assumed to start at offset 0, as the v7+ padding is absolute.
+void write_bundle_header(BinaryWriter &writer, const BundleHeader &header);
+
+struct BundleDirectory {
+  std::vector<ArchiveBlockInfo> blocks;
+  std::vector<ArchiveNode> nodes;
+};
+
+BundleDirectory read_bundle_directory(const BundleHeader &header,
+                                      std::span<const uint8_t> raw_block_info);
+
+// Where every block lands when the bundle is rebuilt with stored blocks.
+// Slots are sized from the block table, so the whole layout is known
+// before anything is decoded.
+struct StoredLayout {
+  std::vector<ArchiveBlockInfo> blocks;
+  std::vector<size_t> slot_offsets;
+  size_t data_size = 0;
+};
+
+StoredLayout plan_stored_layout(const std::vector<ArchiveBlockInfo> &blocks);
+
+// A short LZ4AK block leaves a gap behind its slot. Shrinks such blocks to
+// what was decoded and calls move(from, to, size) for every block that has
+// to slide towards the front, so the stream matches what decoding the
+// blocks back to back would give. Returns true if the block table changed;
+// its encoded length never does.
+template <typename Move>
+bool close_slot_gaps(StoredLayout &layout,
+                     const std::vector<size_t> &decoded_sizes, Move &&move) {
+  size_t decoded_total = 0;
+  bool resized = false;
+  for (size_t i = 0; i < layout.blocks.size(); ++i) {
+    if (layout.slot_offsets[i] != decoded_total)
+      move(layout.slot_offsets[i], decoded_total, decoded_sizes[i]);
+    if (decoded_sizes[i] != layout.blocks[i].uncompressed_size) {
+      layout.blocks[i].uncompressed_size =
+          static_cast<uint32_t>(decoded_sizes[i]);
+      layout.blocks[i].compressed_size =
+          static_cast<uint32_t>(decoded_sizes[i]);
+      resized = true;
+    }
+    layout.slot_offsets[i] = decoded_total;
+    decoded_total += decoded_sizes[i];
+  }
+  layout.data_size = decoded_total;
+  return resized;
+}
+
+// The rebuilt header followed by its uncompressed block info; the data
+// section starts right after it.
+std::vector<uint8_t> build_stored_prefix(const BundleHeader &header,
+                                         const StoredLayout &layout,
+                                         const std::vector<ArchiveNode> &nodes);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <stdexcept>
+
+// Heap byte buffer that is NOT zero-filled on allocation, for destinations
+// a codec or a read is about to overwrite anyway. The size can only shrink,
+// which is all the decoders need when a block comes up short.
+class ByteBuffer {
+  std::unique_ptr<uint8_t[]> data_;
+  size_t size_ = 0;
+
+public:
+  ByteBuffer() = default;
+  explicit ByteBuffer(size_t size)
+      : data_(std::make_unique_for_overwrite<uint8_t[]>(size)), size_(size) {}
+
+  uint8_t *data() { return data_.get(); }
+  const uint8_t *data() const { return data_.get(); }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  uint8_t *begin() { return data(); }
+  uint8_t *end() { return data() + size_; }
+  const uint8_t *begin() const { return data(); }
+  const uint8_t *end() const { return data() + size_; }
+
+  std::span<uint8_t> span() { return {data(), size_}; }
+  std::span<const uint8_t> span() const { return {data(), size_}; }
+  operator std::span<uint8_t>() { return span(); }
+  operator std::span<const uint8_t>() const { return span(); }
+
+  void shrink(size_t size) {
+    if (size > size_)
+      throw std::length_error("ByteBuffer can only shrink");
+    size_ = size;
+  }
+};
@@ -0,0 +1,400 @@
+#include "codec.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <print>
+#include <utility>
+#include <vector>
+
+#include <LzmaLib.h>
+#include <lz4.h>
+#include <lz4hc.h>
+
+#include "lz4ak.h"
+#include "lzham_static_lib.h"
+
+namespace {
+
+size_t decompress_lzak(std::span<const uint8_t> compressed_data,
+                       std::span<uint8_t> dest) {
+  if (compressed_data.empty())
+    return 0;
+
+  int result = lz4ak_decompress_safe(compressed_data, dest);
+
+  if (result < 0) {
+    throw std::runtime_error(
+        std::format("LZ4AK decompression failed with code: {}", result));
+  }
+
+  if (static_cast<size_t>(result) != dest.size()) {
+    std::println(stderr, "Warning: LZ4AK expected {} bytes, got {}",
+                 dest.size(), result);
+  }
+
+  return static_cast<size_t>(result);
+}
+
+// Keeps one decompressor alive per thread and reinitialises it between
+// blocks, instead of building and tearing down a fresh one for every block
+// the way lzham_decompress_memory does.
+class LzhamDecoder {
+  lzham_decompress_state_ptr state_ = nullptr;
+
+public:
+  LzhamDecoder() = default;
+  ~LzhamDecoder() {
+    if (state_)
+      lzham_decompress_deinit(state_);
+  }
+
+  LzhamDecoder(const LzhamDecoder &) = delete;
+  LzhamDecoder &operator=(const LzhamDecoder &) = delete;
+
+  void decode(std::span<const uint8_t> src, std::span<uint8_t> dst) {
+    lzham_decompress_params params{};
+    params.m_struct_size = sizeof(lzham_decompress_params);
+    params.m_dict_size_log2 = LZHAM_DICT_SIZE_LOG2;
+    params.m_decompress_flags = LZHAM_DECOMP_FLAG_OUTPUT_UNBUFFERED;
+
+    lzham_decompress_state_ptr state =
+        state_ ? lzham_decompress_reinit(state_, &params)
+               : lzham_decompress_init(&params);
+    if (!state)
+      throw std::runtime_error("LZHAM init failed");
+    state_ = state;
+
+    size_t src_len = src.size();
+    size_t dst_len = dst.size();
+    lzham_decompress_status_t status = lzham_decompress(
+        state_, src.data(), &src_len, dst.data(), &dst_len, true);
+    if (status != LZHAM_DECOMP_STATUS_SUCCESS) {
+      throw std::runtime_error(
+          std::format("LZHAM Decomp failed: {}", static_cast<int>(status)));
+    }
+  }
+};
+
+// ISzAlloc that parks freed allocations on a small per-thread free list and
+// hands them back for requests of the same size, so LzmaDec's probability
+// tables are not malloc'ed and freed for every block.
+class PooledAlloc : public ISzAlloc {
+  static constexpr size_t MAX_CACHED = 4;
+
+  struct FreeList {
+    std::vector<std::pair<size_t, void *>> entries;
+    ~FreeList() {
+      for (auto &e : entries)
+        std::free(e.second);
+    }
+  };
+
+  static FreeList &free_list() {
+    thread_local FreeList list;
+    return list;
+  }
+
+  // LzmaDec only hands the size back on allocation, so it is stored in a
+  // header in front of every block.
+  static constexpr size_t HEADER = alignof(std::max_align_t);
+
+  static void *alloc(ISzAllocPtr, size_t size) {
+    auto &entries = free_list().entries;
+    for (size_t i = 0; i < entries.size(); ++i) {
+      if (entries[i].first == size) {
+        void *block = entries[i].second;
+        entries.erase(entries.begin() + i);
+        return static_cast<uint8_t *>(block) + HEADER;
+      }
+    }
+    void *block = std::malloc(size + HEADER);
+    if (!block)
+      return nullptr;
+    std::memcpy(block, &size, sizeof(size));
+    return static_cast<uint8_t *>(block) + HEADER;
+  }
+
+  static void free(ISzAllocPtr, void *address) {
+    if (!address)
+      return;
+    void *block = static_cast<uint8_t *>(address) - HEADER;
+    size_t size;
+    std::memcpy(&size, block, sizeof(size));
+    auto &entries = free_list().entries;
+    if (entries.size() == MAX_CACHED) {
+      std::free(entries.front().second);
+      entries.erase(entries.begin());
+    }
+    entries.emplace_back(size, block);
+  }
+
+public:
+  PooledAlloc() : ISzAlloc{alloc, free} {}
+
+  // Creates this thread's free list. Thread-locals are destroyed in reverse
+  // order of construction, so a thread-local decoder must call this before
+  // it allocates for the list to outlive the frees in its destructor.
+  static void retain_free_list() { free_list(); }
+};
+
+const PooledAlloc lzma_alloc;
+
+} // namespace
+
+void LzmaDecoder::set_props(std::span<const uint8_t> block) {
+  if (block.size() < LZMA_PROPS_SIZE)
+    throw std::runtime_error("Invalid LZMA data");
+  if (LzmaDec_AllocateProbs(&dec_, block.data(), LZMA_PROPS_SIZE,
+                            &lzma_alloc) != SZ_OK)
+    throw std::runtime_error("Invalid LZMA properties");
+}
+
+void LzmaDecoder::start_chunked(std::span<const uint8_t> props,
+                                uint64_t size) {
+  set_props(props);
+  size_t window_size = window_size_for(props, size);
+  if (window_.size() < window_size)
+    window_ = ByteBuffer(window_size);
+  dec_.dic = window_.data();
+  dec_.dicBufSize = window_size;
+  LzmaDec_Init(&dec_);
+}
+
+LzmaDecoder::LzmaDecoder() {
+  PooledAlloc::retain_free_list();
+  LzmaDec_Construct(&dec_);
+}
+LzmaDecoder::~LzmaDecoder() { LzmaDec_FreeProbs(&dec_, &lzma_alloc); }
+
+void LzmaDecoder::decode(std::span<const uint8_t> block,
+                         std::span<uint8_t> dst) {
+  set_props(block);
+  dec_.dic = dst.data();
+  dec_.dicBufSize = dst.size();
+  LzmaDec_Init(&dec_);
+
+  SizeT src_len = block.size() - LZMA_PROPS_SIZE;
+  ELzmaStatus status;
+  SRes res =
+      LzmaDec_DecodeToDic(&dec_, dst.size(), block.data() + LZMA_PROPS_SIZE,
+                          &src_len, LZMA_FINISH_ANY, &status);
+  size_t produced = dec_.dicPos;
+  detach_window();
+  if (res != SZ_OK || produced != dst.size())
+    throw std::runtime_error("LZMA Decomp failed");
+}
+
+std::string_view compression_name(CompressionType type, GameMode mode) {
+  switch (type) {
+  case CompressionType::None:
+    return "none";
+  case CompressionType::Lzma:
+    return "lzma";
+  case CompressionType::Lz4:
+    return "lz4";
+  case CompressionType::Lz4hc:
+    return "lz4hc";
+  case CompressionType::Lzham:
+    return mode == GameMode::Arknights ? "lz4ak" : "lzham";
+  }
+  return "unknown";
+}
+
+size_t LzmaDecoder::window_size_for(std::span<const uint8_t> props,
+                                    uint64_t size) {
+  CLzmaProps p;
+  if (props.size() < LZMA_PROPS_SIZE ||
+      LzmaProps_Decode(&p, props.data(), LZMA_PROPS_SIZE) != SZ_OK)
+    throw std::runtime_error("Invalid LZMA properties");
+  // A window covering the whole block already satisfies every distance
+  // the stream can use, however large the declared dictionary is.
+  return static_cast<size_t>(
+      std::max<uint64_t>(std::min<uint64_t>(p.dicSize, size), 1));
+}
+
+LzmaDecoder &thread_lzma_decoder() {
+  thread_local LzmaDecoder decoder;
+  return decoder;
+}
+
+size_t decompress_block_into(CompressionType type, std::span<const uint8_t> src,
+                             std::span<uint8_t> dst, GameMode mode) {
+  if (type == CompressionType::None) {
+    if (src.size() > dst.size())
+      throw std::runtime_error("Stored block larger than its slot");
+    std::copy(src.begin(), src.end(), dst.begin());
+    return src.size();
+  }
+
+  switch (type) {
+  case CompressionType::Lzma: {
+    thread_lzma_decoder().decode(src, dst);
+    break;
+  }
+
+  case CompressionType::Lz4:
+  case CompressionType::Lz4hc: {
+    int res = LZ4_decompress_safe(reinterpret_cast<const char *>(src.data()),
+                                  reinterpret_cast<char *>(dst.data()),
+                                  static_cast<int>(src.size()),
+                                  static_cast<int>(dst.size()));
+    if (res < 0)
+      throw std::runtime_error("LZ4 Decomp failed");
+    break;
+  }
+
+  case CompressionType::Lzham: {
+    if (mode == GameMode::Arknights) {
+      return decompress_lzak(src, dst);
+    } else {
+      thread_local LzhamDecoder lzham;
+      lzham.decode(src, dst);
+    }
+    break;
+  }
+  default:
+    throw std::runtime_error("Unknown compression type");
+  }
+  return dst.size();
+}
+
+ByteBuffer decompress_block(CompressionType type, std::span<const uint8_t> src,
+                            uint32_t decompressed_size, GameMode mode) {
+  ByteBuffer dst(type == CompressionType::None ? src.size()
+                                               : decompressed_size);
+  dst.shrink(decompress_block_into(type, src, dst, mode));
+  return dst;
+}
+
+void decompress_block_prefix(CompressionType type,
+                             std::span<const uint8_t> src,
+                             std::span<uint8_t> dst, uint32_t block_size,
+                             GameMode mode) {
+  if (dst.empty())
+    return;
+
+  switch (type) {
+  case CompressionType::None:
+    if (src.size() < dst.size())
+      throw std::runtime_error("Stored block shorter than requested");
+    std::copy_n(src.begin(), dst.size(), dst.begin());
+    return;
+
+  case CompressionType::Lzma:
+    thread_lzma_decoder().decode(src, dst);
+    return;
+
+  case CompressionType::Lz4:
+  case CompressionType::Lz4hc: {
+    int res = LZ4_decompress_safe_partial(
+        reinterpret_cast<const char *>(src.data()),
+        reinterpret_cast<char *>(dst.data()), static_cast<int>(src.size()),
+        static_cast<int>(dst.size()), static_cast<int>(dst.size()));
+    if (res < 0 || static_cast<size_t>(res) != dst.size())
+      throw std::runtime_error("LZ4 Decomp failed");
+    return;
+  }
+
+  default: {
+    ByteBuffer full = decompress_block(type, src, block_size, mode);
+    if (full.size() < dst.size())
+      throw std::runtime_error(std::format(
+          "Block decoded to {} bytes, {} requested", full.size(), dst.size()));
+    std::copy_n(full.begin(), dst.size(), dst.begin());
+    return;
+  }
+  }
+}
+
+namespace {
+
+ByteBuffer compress_lzma(std::span<const uint8_t> src, int level) {
+  // Unity's own settings, with the dictionary capped at the block so small
+  // blocks do not declare a 8 MiB window the decoder would have to honour.
+  unsigned dict_size = static_cast<unsigned>(
+      std::clamp<size_t>(src.size(), size_t{1} << 12, size_t{1} << 23));
+  size_t capacity = src.size() + src.size() / 3 + 128;
+  ByteBuffer dst(LZMA_PROPS_SIZE + capacity);
+  size_t props_size = LZMA_PROPS_SIZE;
+  int res = LzmaCompress(dst.data() + LZMA_PROPS_SIZE, &capacity, src.data(),
+                         src.size(), dst.data(), &props_size,
+                         level < 0 ? 5 : level, dict_size, 3, 0, 2, 32, 1);
+  if (res != SZ_OK || props_size != LZMA_PROPS_SIZE)
+    throw std::runtime_error(
+        std::format("LZMA compression failed with code: {}", res));
+  dst.shrink(LZMA_PROPS_SIZE + capacity);
+  return dst;
+}
+
+ByteBuffer compress_lz4(std::span<const uint8_t> src, bool hc, int level) {
+  if (src.size() > LZ4_MAX_INPUT_SIZE)
+    throw std::runtime_error("Block too large for LZ4");
+  const int src_len = static_cast<int>(src.size());
+  ByteBuffer dst(LZ4_compressBound(src_len));
+  const char *in = reinterpret_cast<const char *>(src.data());
+  char *out = reinterpret_cast<char *>(dst.data());
+  int res = hc ? LZ4_compress_HC(in, out, src_len,
+                                 static_cast<int>(dst.size()),
+                                 level < 0 ? LZ4HC_CLEVEL_DEFAULT : level)
+               : LZ4_compress_default(in, out, src_len,
+                                      static_cast<int>(dst.size()));
+  if (res <= 0 && src_len != 0)
+    throw std::runtime_error("LZ4 compression failed");
+  dst.shrink(static_cast<size_t>(std::max(res, 0)));
+  return dst;
+}
+
+ByteBuffer compress_lzham(std::span<const uint8_t> src, int level) {
+  lzham_compress_params params{};
+  params.m_struct_size = sizeof(lzham_compress_params);
+  params.m_dict_size_log2 = LZHAM_DICT_SIZE_LOG2;
+  params.m_level = level < 0
+                       ? LZHAM_COMP_LEVEL_DEFAULT
+                       : static_cast<lzham_compress_level>(
+                             std::min(level, int{LZHAM_COMP_LEVEL_UBER}));
+
+  size_t dst_len = src.size() + src.size() / 8 + 1024;
+  ByteBuffer dst(dst_len);
+  lzham_compress_status_t status = lzham_compress_memory(
+      &params, dst.data(), &dst_len, src.data(), src.size(), nullptr);
+  if (status != LZHAM_COMP_STATUS_SUCCESS)
+    throw std::runtime_error(std::format("LZHAM compression failed: {}",
+                                         static_cast<int>(status)));
+  dst.shrink(dst_len);
+  return dst;
+}
+
+} // namespace
+
+ByteBuffer compress_block(CompressionType type, std::span<const uint8_t> src,
+                          GameMode mode, int level) {
+  switch (type) {
+  case CompressionType::None: {
+    ByteBuffer dst(src.size());
+    std::copy(src.begin(), src.end(), dst.begin());
+    return dst;
+  }
+
+  case CompressionType::Lzma:
+    return compress_lzma(src, level);
+
+  case CompressionType::Lz4:
+    return compress_lz4(src, false, level);
+
+  case CompressionType::Lz4hc:
+    return compress_lz4(src, true, level);
+
+  case CompressionType::Lzham: {
+    if (mode != GameMode::Arknights)
+      return compress_lzham(src, level);
+    // LZ4AK is a byte-level rewrite of plain LZ4, so any LZ4 encoder will
+    // do; an explicit level selects the HC one.
+    ByteBuffer dst = compress_lz4(src, level >= 0, level);
+    if (!lz4ak_from_lz4(dst))
+      throw std::runtime_error("LZ4AK conversion failed");
+    return dst;
+  }
+  }
+  throw std::runtime_error("Unknown compression type");
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+
+#include <LzmaDec.h>
+
+#include "byte_buffer.h"
+
+enum class CompressionType : uint8_t {
+  None = 0,
+  Lzma = 1,
+  Lz4 = 2,
+  Lz4hc = 3,
+  Lzham = 4,
+};
+
+enum class GameMode { Standard, Arknights };
+
+// Short lowercase codec name ("lz4hc", ...), reporting the LZHAM slot as
+// "lz4ak" in Arknights mode.
+std::string_view compression_name(CompressionType type, GameMode mode);
+
+// LZHAM's position-slot model is derived from the dictionary size, so the
+// decoder has to use the value Unity compressed with rather than anything
+// derived from the block. Decoding is unbuffered, straight into the block's
+// destination, so this does not allocate a window of that size.
+constexpr uint32_t LZHAM_DICT_SIZE_LOG2 = 29;
+
+// Decodes one block into `dst`, which must hold the block's uncompressed
+// size (or the stored size for uncompressed blocks). Returns the number of
+// bytes the block actually occupies, which is only ever short for LZ4AK.
+size_t decompress_block_into(CompressionType type, std::span<const uint8_t> src,
+                             std::span<uint8_t> dst, GameMode mode);
+
+ByteBuffer decompress_block(CompressionType type, std::span<const uint8_t> src,
+                            uint32_t decompressed_size, GameMode mode);
+
+// Decodes just the first dst.size() bytes of a block that decodes to
+// `block_size` bytes in full. LZMA and LZ4 stop as soon as `dst` is full;
+// the other codecs decode the whole block into scratch memory first.
+void decompress_block_prefix(CompressionType type,
+                             std::span<const uint8_t> src,
+                             std::span<uint8_t> dst, uint32_t block_size,
+                             GameMode mode);
+
+// Encodes one block the way Unity lays it out for `type`: LZMA blocks carry
+// their 5 property bytes up front, and in Arknights mode the LZHAM slot
+// holds LZ4AK. `level` is codec-specific; a negative value picks the
+// codec's default.
+ByteBuffer compress_block(CompressionType type, std::span<const uint8_t> src,
+                          GameMode mode, int level = -1);
+
+// LZMA decoder built on the LzmaDec state API. One instance lives per
+// thread and is reused for every block: the probability tables are only
+// reallocated when a block's lc/lp change, and the window used for
+// chunked decoding only ever grows.
+class LzmaDecoder {
+  CLzmaDec dec_;
+  ByteBuffer window_;
+
+  void set_props(std::span<const uint8_t> block);
+  void start_chunked(std::span<const uint8_t> props, uint64_t size);
+  void detach_window() {
+    dec_.dic = nullptr;
+    dec_.dicBufSize = 0;
+  }
+
+public:
+  LzmaDecoder();
+  ~LzmaDecoder();
+
+  LzmaDecoder(const LzmaDecoder &) = delete;
+  LzmaDecoder &operator=(const LzmaDecoder &) = delete;
+
+  // Decodes a whole block (5 property bytes followed by the stream) with
+  // `dst` itself as the window. A `dst` shorter than the block decodes
+  // just that prefix.
+  void decode(std::span<const uint8_t> block, std::span<uint8_t> dst);
+
+  // Decodes a block of `size` bytes in pieces: read(span) must fill the
+  // span with the next compressed bytes (after the properties) and return
+  // how many it provided, and write(span) receives the output in order.
+  // Only a window of min(dictionary, size) bytes plus the caller's chunk
+  // buffers is ever resident.
+  template <typename Read, typename Write>
+  void decode_chunked(std::span<const uint8_t> props, uint64_t size,
+                      std::span<uint8_t> in_buf, std::span<uint8_t> out_buf,
+                      Read &&read, Write &&write) {
+    start_chunked(props, size);
+
+    size_t in_pos = 0;
+    size_t in_len = 0;
+    bool input_done = false;
+    uint64_t written = 0;
+    try {
+      while (written < size) {
+        if (in_pos == in_len && !input_done) {
+          in_len = read(in_buf);
+          in_pos = 0;
+          input_done = in_len == 0;
+        }
+
+        SizeT src_len = in_len - in_pos;
+        SizeT out_len = static_cast<SizeT>(
+            std::min<uint64_t>(out_buf.size(), size - written));
+        ELzmaStatus status;
+        SRes res = LzmaDec_DecodeToBuf(&dec_, out_buf.data(), &out_len,
+                                       in_buf.data() + in_pos, &src_len,
+                                       LZMA_FINISH_ANY, &status);
+        if (res != SZ_OK)
+          throw std::runtime_error("LZMA Decomp failed");
+        in_pos += src_len;
+        if (out_len != 0)
+          write(out_buf.first(out_len));
+        written += out_len;
+
+        if (written < size &&
+            (status == LZMA_STATUS_FINISHED_WITH_MARK ||
+             (input_done && out_len == 0)))
+          throw std::runtime_error("LZMA Decomp failed: stream ended early");
+      }
+    } catch (...) {
+      detach_window();
+      throw;
+    }
+    detach_window();
+  }
+
+  // Window decode_chunked allocates for a block with these properties.
+  static size_t window_size_for(std::span<const uint8_t> props,
+                                uint64_t size);
+};
+
+LzmaDecoder &thread_lzma_decoder();
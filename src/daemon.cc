@@ -0,0 +1,272 @@
+#include "daemon.h"
+
+#include <atomic>
+#include <format>
+#include <print>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "parallel.h"
+#include "stats.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+#ifdef _WIN32
+
+void run_daemon(const fs::path &, const ProcessOptions &) {
+  throw std::runtime_error("--daemon needs Unix domain sockets");
+}
+
+#else
+
+namespace {
+
+// A request line is a command and a few paths; anything longer is not a
+// client of ours.
+constexpr size_t MAX_REQUEST_SIZE = 64 << 10;
+
+// How long a worker waits for a connected client to send its request.
+constexpr int REQUEST_TIMEOUT_SECONDS = 10;
+
+[[noreturn]] void throw_socket_error(const char *what) {
+  throw std::system_error(errno, std::system_category(), what);
+}
+
+std::vector<std::string_view> split_fields(std::string_view line) {
+  std::vector<std::string_view> fields;
+  size_t start = 0;
+  for (;;) {
+    size_t tab = line.find('\t', start);
+    fields.push_back(line.substr(start, tab - start));
+    if (tab == std::string_view::npos)
+      return fields;
+    start = tab + 1;
+  }
+}
+
+GameMode parse_game(std::string_view game) {
+  if (game == "std")
+    return GameMode::Standard;
+  if (game == "arknights")
+    return GameMode::Arknights;
+  throw std::runtime_error(std::format("Unknown game mode: {}", game));
+}
+
+// Runs one request and returns the response payload (without "ok\t").
+std::string handle_request(std::string_view line, ProcessOptions options,
+                           bool &shutdown) {
+  auto fields = split_fields(line);
+  std::string_view command = fields[0];
+
+  auto expect = [&](size_t count, const char *usage) {
+    if (fields.size() != count)
+      throw std::runtime_error(std::format("usage: {}", usage));
+  };
+
+  if (command == "ping") {
+    expect(1, "ping");
+    return "pong";
+  }
+  if (command == "shutdown") {
+    expect(1, "shutdown");
+    shutdown = true;
+    return "bye";
+  }
+  if (command == "decompress") {
+    expect(4, "decompress <game> <input> <output>");
+    options.game_mode = parse_game(fields[1]);
+    fs::path output(fields[3]);
+    convert_file(fs::path(fields[2]), output, options);
+    return output.string();
+  }
+  if (command == "extract") {
+    expect(5, "extract <game> <input> <node-path> <output>");
+    options.game_mode = parse_game(fields[1]);
+    options.extract_node = fields[3];
+    fs::path output(fields[4]);
+    convert_file(fs::path(fields[2]), output, options);
+    return output.string();
+  }
+  if (command == "stats") {
+    expect(1, "stats");
+    if (!options.stats)
+      throw std::runtime_error("Daemon was started without --stats");
+    return options.stats->json();
+  }
+  if (command == "list") {
+    expect(3, "list <game> <input>");
+    return list_bundle_json(fs::path(fields[2]), parse_game(fields[1]));
+  }
+  throw std::runtime_error(std::format("Unknown command: {}", command));
+}
+
+// Reads one newline-terminated request; returns false if the client went
+// away, timed out or sent something too long.
+bool read_request(int fd, std::string &line) {
+  char buf[4096];
+  while (line.size() < MAX_REQUEST_SIZE) {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    line.append(buf, static_cast<size_t>(n));
+    size_t newline = line.find('\n');
+    if (newline != std::string::npos) {
+      line.resize(newline);
+      if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void write_response(int fd, std::string_view response) {
+  while (!response.empty()) {
+    ssize_t n = send(fd, response.data(), response.size(), 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return;
+    response.remove_prefix(static_cast<size_t>(n));
+  }
+}
+
+// Messages end up on a single response line.
+std::string one_line(std::string text) {
+  for (char &c : text)
+    if (c == '\n' || c == '\r' || c == '\t')
+      c = ' ';
+  return text;
+}
+
+} // namespace
+
+void run_daemon(const fs::path &socket_path, const ProcessOptions &options) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  std::string path = socket_path.string();
+  if (path.size() >= sizeof(addr.sun_path))
+    throw std::runtime_error(std::format("Socket path too long: {}", path));
+  path.copy(addr.sun_path, path.size());
+
+  // A socket left behind by a previous run would make bind fail; anything
+  // else at that path is not ours to remove.
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path.c_str());
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0)
+    throw_socket_error("socket");
+  if (bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) !=
+          0 ||
+      listen(listen_fd, SOMAXCONN) != 0) {
+    int err = errno;
+    close(listen_fd);
+    throw std::system_error(err, std::system_category(),
+                            std::format("Cannot listen on {}", path));
+  }
+
+  // A shutdown request wakes the accept loop through this pipe; closing
+  // or shutting down the listening socket does not wake a blocked
+  // accept() everywhere. The listening socket is non-blocking so a client
+  // that goes away between poll() and accept() cannot block the loop.
+  int wake[2];
+  if (pipe(wake) != 0) {
+    int err = errno;
+    close(listen_fd);
+    throw std::system_error(err, std::system_category(), "pipe");
+  }
+  fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+
+  // A client hanging up before its response must not kill the daemon.
+  std::signal(SIGPIPE, SIG_IGN);
+
+  ProcessOptions job_options = options;
+  job_options.threads = 1;
+  job_options.quiet = true;
+
+  std::atomic<bool> stopping{false};
+  int loop_error = 0;
+  const char *loop_call = nullptr;
+  {
+    ThreadPool pool(options.threads);
+    if (!options.quiet)
+      std::println("Listening on {} with {} workers", path, pool.size());
+
+    while (!stopping) {
+      pollfd fds[2] = {{listen_fd, POLLIN, 0}, {wake[0], POLLIN, 0}};
+      if (poll(fds, 2, -1) < 0) {
+        if (errno == EINTR)
+          continue;
+        loop_error = errno;
+        loop_call = "poll";
+        break;
+      }
+      if (fds[1].revents != 0)
+        break;
+
+      int fd = accept(listen_fd, nullptr, nullptr);
+      if (fd < 0) {
+        if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN ||
+            errno == EWOULDBLOCK)
+          continue;
+        loop_error = errno;
+        loop_call = "accept";
+        break;
+      }
+      // BSD and macOS hand the listening socket's O_NONBLOCK down to it.
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+      pool.submit([fd, wake_fd = wake[1], &stopping, &job_options] {
+        timeval timeout{REQUEST_TIMEOUT_SECONDS, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        std::string line;
+        if (read_request(fd, line)) {
+          std::string response;
+          bool shutdown = false;
+          try {
+            response = "ok\t" + handle_request(line, job_options, shutdown);
+          } catch (const std::exception &e) {
+            response = "error\t" + one_line(e.what());
+          }
+          write_response(fd, response + "\n");
+          if (shutdown) {
+            stopping = true;
+            char byte = 0;
+            while (write(wake_fd, &byte, 1) < 0 && errno == EINTR) {
+            }
+          }
+        }
+        close(fd);
+      });
+    }
+    // The pool finishes the jobs already accepted before it goes away.
+  }
+
+  close(wake[0]);
+  close(wake[1]);
+  close(listen_fd);
+  unlink(path.c_str());
+  if (loop_error != 0)
+    throw std::system_error(loop_error, std::system_category(), loop_call);
+}
+
+#endif
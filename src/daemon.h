@@ -0,0 +1,24 @@
+#pragma once
+
+#include <filesystem>
+
+#include "process.h"
+
+// Serves jobs over a Unix domain socket so callers skip process startup
+// and cold decoders. Each connection carries one request line of
+// tab-separated fields and gets one response line back:
+//
+//   decompress <std|arknights> <input> <output>
+//   extract    <std|arknights> <input> <node-path> <output>
+//   list       <std|arknights> <input>
+//   stats      (the --stats counters so far, as JSON)
+//   ping
+//   shutdown
+//
+// Responses are "ok\t<output path | JSON | pong>" or "error\t<message>".
+// Jobs run on a persistent pool of options.threads workers (each job on
+// one of them), so the per-thread decoders and their buffers are reused
+// across requests. `options` supplies everything but the game mode.
+// Returns after a shutdown request once queued jobs have finished.
+void run_daemon(const std::filesystem::path &socket_path,
+                const ProcessOptions &options);
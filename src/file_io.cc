@@ -0,0 +1,440 @@
+#include "file_io.h"
+
+#include <algorithm>
+#include <format>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+namespace {
+
+[[noreturn]] void throw_io_error(const char *what,
+                                 const std::filesystem::path &path) {
+#ifdef _WIN32
+  int code = static_cast<int>(GetLastError());
+#else
+  int code = errno;
+#endif
+  throw std::runtime_error(
+      std::format("{} {}: {}", what, path.string(),
+                  std::system_category().message(code)));
+}
+
+} // namespace
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::filesystem::path &path) {
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    throw_io_error("Cannot open", path);
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    CloseHandle(file);
+    throw_io_error("Cannot stat", path);
+  }
+  size_ = static_cast<size_t>(size.QuadPart);
+  if (size_ == 0) {
+    CloseHandle(file);
+    return;
+  }
+
+  mapping_ = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (!mapping_)
+    throw_io_error("Cannot map", path);
+
+  data_ = static_cast<const uint8_t *>(
+      MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+  if (!data_) {
+    CloseHandle(mapping_);
+    throw_io_error("Cannot map", path);
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (data_)
+    UnmapViewOfFile(data_);
+  if (mapping_)
+    CloseHandle(mapping_);
+}
+
+MappedOutputFile::MappedOutputFile(const std::filesystem::path &path,
+                                   size_t size)
+    : size_(size), path_(path) {
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0,
+                            nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    throw_io_error("Cannot create", path);
+  file_ = file;
+  if (size_ == 0)
+    return;
+
+  LARGE_INTEGER li;
+  li.QuadPart = static_cast<LONGLONG>(size_);
+  mapping_ = CreateFileMappingW(file, nullptr, PAGE_READWRITE, li.HighPart,
+                                li.LowPart, nullptr);
+  if (!mapping_) {
+    CloseHandle(file);
+    throw_io_error("Cannot map", path);
+  }
+  data_ = static_cast<uint8_t *>(
+      MapViewOfFile(mapping_, FILE_MAP_WRITE, 0, 0, 0));
+  if (!data_) {
+    CloseHandle(mapping_);
+    CloseHandle(file);
+    throw_io_error("Cannot map", path);
+  }
+}
+
+void MappedOutputFile::unmap() {
+  if (data_)
+    UnmapViewOfFile(data_);
+  if (mapping_)
+    CloseHandle(mapping_);
+  data_ = nullptr;
+  mapping_ = nullptr;
+}
+
+void MappedOutputFile::close(size_t final_size) {
+  unmap();
+  if (!file_)
+    return;
+  HANDLE file = static_cast<HANDLE>(file_);
+  file_ = nullptr;
+  LARGE_INTEGER li;
+  li.QuadPart = static_cast<LONGLONG>(final_size);
+  bool ok = final_size == size_ ||
+            (SetFilePointerEx(file, li, nullptr, FILE_BEGIN) &&
+             SetEndOfFile(file));
+  CloseHandle(file);
+  if (!ok)
+    throw_io_error("Cannot resize", path_);
+}
+
+MappedOutputFile::~MappedOutputFile() {
+  unmap();
+  if (file_)
+    CloseHandle(static_cast<HANDLE>(file_));
+}
+
+InputFile::InputFile(const std::filesystem::path &path) : path_(path) {
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    throw_io_error("Cannot open", path);
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    CloseHandle(file);
+    throw_io_error("Cannot stat", path);
+  }
+  handle_ = file;
+  size_ = static_cast<uint64_t>(size.QuadPart);
+}
+
+InputFile::~InputFile() {
+  if (handle_)
+    CloseHandle(handle_);
+}
+
+static void read_at_handle(void *handle, uint64_t offset,
+                           std::span<uint8_t> dst,
+                           const std::filesystem::path &path) {
+  while (!dst.empty()) {
+    OVERLAPPED ov{};
+    ov.Offset = static_cast<DWORD>(offset);
+    ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD chunk = static_cast<DWORD>(
+        std::min<size_t>(dst.size(), 1u << 30));
+    DWORD got = 0;
+    if (!ReadFile(handle, dst.data(), chunk, &got, &ov))
+      throw_io_error("Cannot read", path);
+    if (got == 0)
+      throw std::runtime_error(
+          std::format("Unexpected end of file in {}", path.string()));
+    dst = dst.subspan(got);
+    offset += got;
+  }
+}
+
+void InputFile::read_at(uint64_t offset, std::span<uint8_t> dst) const {
+  read_at_handle(handle_, offset, dst, path_);
+}
+
+OutputFile::OutputFile(const std::filesystem::path &path) : path_(path) {
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0,
+                            nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    throw_io_error("Cannot create", path);
+  handle_ = file;
+}
+
+OutputFile::~OutputFile() {
+  if (handle_)
+    CloseHandle(handle_);
+}
+
+void OutputFile::read_at(uint64_t offset, std::span<uint8_t> dst) const {
+  read_at_handle(handle_, offset, dst, path_);
+}
+
+void OutputFile::write_at(uint64_t offset, std::span<const uint8_t> src) {
+  while (!src.empty()) {
+    OVERLAPPED ov{};
+    ov.Offset = static_cast<DWORD>(offset);
+    ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD chunk = static_cast<DWORD>(
+        std::min<size_t>(src.size(), 1u << 30));
+    DWORD put = 0;
+    if (!WriteFile(handle_, src.data(), chunk, &put, &ov))
+      throw_io_error("Cannot write", path_);
+    src = src.subspan(put);
+    offset += put;
+  }
+}
+
+void OutputFile::resize(uint64_t size) {
+  LARGE_INTEGER li;
+  li.QuadPart = static_cast<LONGLONG>(size);
+  if (!SetFilePointerEx(handle_, li, nullptr, FILE_BEGIN) ||
+      !SetEndOfFile(handle_))
+    throw_io_error("Cannot resize", path_);
+}
+
+void OutputFile::close() {
+  if (handle_ && !CloseHandle(handle_)) {
+    handle_ = nullptr;
+    throw_io_error("Cannot finish", path_);
+  }
+  handle_ = nullptr;
+}
+
+#else
+
+MappedFile::MappedFile(const std::filesystem::path &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw_io_error("Cannot open", path);
+
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw_io_error("Cannot stat", path);
+  }
+  size_ = static_cast<size_t>(st.st_size);
+  if (size_ == 0) {
+    ::close(fd);
+    return;
+  }
+
+  void *addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED)
+    throw_io_error("Cannot map", path);
+
+  // Purely advisory: blocks are consumed front to back, and everything in
+  // the file is going to be read, so start readahead right away.
+  ::madvise(addr, size_, MADV_SEQUENTIAL);
+  ::madvise(addr, size_, MADV_WILLNEED);
+
+  data_ = static_cast<const uint8_t *>(addr);
+}
+
+MappedFile::~MappedFile() {
+  if (data_)
+    ::munmap(const_cast<uint8_t *>(data_), size_);
+}
+
+MappedOutputFile::MappedOutputFile(const std::filesystem::path &path,
+                                   size_t size)
+    : size_(size), path_(path) {
+  fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0)
+    throw_io_error("Cannot create", path);
+  if (size_ == 0)
+    return;
+
+  if (::ftruncate(fd_, static_cast<off_t>(size_)) != 0) {
+    ::close(fd_);
+    throw_io_error("Cannot resize", path);
+  }
+
+  void *addr =
+      ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (addr == MAP_FAILED) {
+    ::close(fd_);
+    throw_io_error("Cannot map", path);
+  }
+  data_ = static_cast<uint8_t *>(addr);
+}
+
+void MappedOutputFile::unmap() {
+  if (data_)
+    ::munmap(data_, size_);
+  data_ = nullptr;
+}
+
+void MappedOutputFile::close(size_t final_size) {
+  unmap();
+  if (fd_ < 0)
+    return;
+  int fd = fd_;
+  fd_ = -1;
+  bool ok = final_size == size_ ||
+            ::ftruncate(fd, static_cast<off_t>(final_size)) == 0;
+  ok = ::close(fd) == 0 && ok;
+  if (!ok)
+    throw_io_error("Cannot finish", path_);
+}
+
+MappedOutputFile::~MappedOutputFile() {
+  unmap();
+  if (fd_ >= 0)
+    ::close(fd_);
+}
+
+InputFile::InputFile(const std::filesystem::path &path) : path_(path) {
+  fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0)
+    throw_io_error("Cannot open", path);
+  struct stat st;
+  if (::fstat(fd_, &st) != 0) {
+    ::close(fd_);
+    throw_io_error("Cannot stat", path);
+  }
+  size_ = static_cast<uint64_t>(st.st_size);
+}
+
+InputFile::~InputFile() {
+  if (fd_ >= 0)
+    ::close(fd_);
+}
+
+static void read_at_fd(int fd, uint64_t offset, std::span<uint8_t> dst,
+                       const std::filesystem::path &path) {
+  while (!dst.empty()) {
+    ssize_t got = ::pread(fd, dst.data(), dst.size(),
+                          static_cast<off_t>(offset));
+    if (got < 0) {
+      if (errno == EINTR)
+        continue;
+      throw_io_error("Cannot read", path);
+    }
+    if (got == 0)
+      throw std::runtime_error(
+          std::format("Unexpected end of file in {}", path.string()));
+    dst = dst.subspan(static_cast<size_t>(got));
+    offset += static_cast<uint64_t>(got);
+  }
+}
+
+void InputFile::read_at(uint64_t offset, std::span<uint8_t> dst) const {
+  read_at_fd(fd_, offset, dst, path_);
+}
+
+OutputFile::OutputFile(const std::filesystem::path &path) : path_(path) {
+  fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0)
+    throw_io_error("Cannot create", path);
+}
+
+OutputFile::~OutputFile() {
+  if (fd_ >= 0)
+    ::close(fd_);
+}
+
+void OutputFile::read_at(uint64_t offset, std::span<uint8_t> dst) const {
+  read_at_fd(fd_, offset, dst, path_);
+}
+
+void OutputFile::write_at(uint64_t offset, std::span<const uint8_t> src) {
+  while (!src.empty()) {
+    ssize_t put = ::pwrite(fd_, src.data(), src.size(),
+                           static_cast<off_t>(offset));
+    if (put < 0) {
+      if (errno == EINTR)
+        continue;
+      throw_io_error("Cannot write", path_);
+    }
+    src = src.subspan(static_cast<size_t>(put));
+    offset += static_cast<uint64_t>(put);
+  }
+}
+
+void OutputFile::resize(uint64_t size) {
+  if (::ftruncate(fd_, static_cast<off_t>(size)) != 0)
+    throw_io_error("Cannot resize", path_);
+}
+
+void OutputFile::close() {
+  int fd = fd_;
+  fd_ = -1;
+  if (fd >= 0 && ::close(fd) != 0)
+    throw_io_error("Cannot finish", path_);
+}
+
+#endif
+
+namespace {
+
+// Shares the extents of `from` with a new file `to`, so later writes to
+// either never affect the other. Only some filesystems (btrfs, XFS) can.
+bool try_reflink(const std::filesystem::path &from,
+                 const std::filesystem::path &to) {
+#ifdef __linux__
+  int src = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+  if (src < 0)
+    return false;
+  int dst = ::open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (dst < 0) {
+    ::close(src);
+    return false;
+  }
+  bool ok = ::ioctl(dst, FICLONE, src) == 0;
+  ::close(src);
+  if (::close(dst) != 0)
+    ok = false;
+  if (!ok)
+    ::unlink(to.c_str());
+  return ok;
+#else
+  (void)from;
+  (void)to;
+  return false;
+#endif
+}
+
+} // namespace
+
+void link_file(const std::filesystem::path &from,
+               const std::filesystem::path &to) {
+  if (try_reflink(from, to))
+    return;
+  std::error_code ec;
+  std::filesystem::create_hard_link(from, to, ec);
+  if (!ec)
+    return;
+  std::filesystem::copy_file(from, to);
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+
+// Read-only view of a whole file. On POSIX the file is mmap'ed and the
+// kernel is told we will stream through it front to back; on Windows it
+// goes through a file mapping object. Empty files map to an empty span.
+class MappedFile {
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+#ifdef _WIN32
+  void *mapping_ = nullptr;
+#endif
+
+public:
+  explicit MappedFile(const std::filesystem::path &path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  std::span<const uint8_t> data() const { return {data_, size_}; }
+  size_t size() const { return size_; }
+};
+
+// Writable mapping of a freshly created (or truncated) output file that is
+// sized up front, so decoders can write straight into their final place.
+// close() may shrink the file to the bytes actually used; the destructor
+// unmaps whatever state is left without shrinking it.
+class MappedOutputFile {
+  uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+#ifdef _WIN32
+  void *file_ = nullptr;
+  void *mapping_ = nullptr;
+#else
+  int fd_ = -1;
+#endif
+  std::filesystem::path path_;
+
+  void unmap();
+
+public:
+  MappedOutputFile(const std::filesystem::path &path, size_t size);
+  ~MappedOutputFile();
+
+  MappedOutputFile(const MappedOutputFile &) = delete;
+  MappedOutputFile &operator=(const MappedOutputFile &) = delete;
+
+  std::span<uint8_t> data() { return {data_, size_}; }
+  size_t size() const { return size_; }
+
+  void close(size_t final_size);
+};
+
+// Unmapped file handles for positioned I/O, for the paths that must not
+// pull a whole file into the address space. Reads and writes at explicit
+// offsets are safe to issue from several threads at once; short reads and
+// writes are retried and anything else throws.
+class InputFile {
+#ifdef _WIN32
+  void *handle_ = nullptr;
+#else
+  int fd_ = -1;
+#endif
+  uint64_t size_ = 0;
+  std::filesystem::path path_;
+
+public:
+  explicit InputFile(const std::filesystem::path &path);
+  ~InputFile();
+
+  InputFile(const InputFile &) = delete;
+  InputFile &operator=(const InputFile &) = delete;
+
+  uint64_t size() const { return size_; }
+  void read_at(uint64_t offset, std::span<uint8_t> dst) const;
+};
+
+class OutputFile {
+#ifdef _WIN32
+  void *handle_ = nullptr;
+#else
+  int fd_ = -1;
+#endif
+  std::filesystem::path path_;
+
+public:
+  // Creates the file, truncating any existing one.
+  explicit OutputFile(const std::filesystem::path &path);
+  ~OutputFile();
+
+  OutputFile(const OutputFile &) = delete;
+  OutputFile &operator=(const OutputFile &) = delete;
+
+  void read_at(uint64_t offset, std::span<uint8_t> dst) const;
+  void write_at(uint64_t offset, std::span<const uint8_t> src);
+  void resize(uint64_t size);
+  void close();
+};
+
+// Creates `to` (which must not exist) with the contents of `from` as
+// cheaply as the filesystem allows: a copy-on-write clone where supported,
+// else a hard link, else a plain copy.
+void link_file(const std::filesystem::path &from,
+               const std::filesystem::path &to);
@@ -0,0 +1,61 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+size_t LatencyHistogram::bucket_of(uint64_t ns) {
+  if (ns < SUB_BUCKETS)
+    return static_cast<size_t>(ns);
+  unsigned shift = std::bit_width(ns) - 1 - SUB_BUCKET_BITS;
+  if (shift > MAX_SHIFT)
+    return BUCKETS - 1;
+  return (shift + 1) * SUB_BUCKETS + ((ns >> shift) - SUB_BUCKETS);
+}
+
+uint64_t LatencyHistogram::bucket_top(size_t bucket) {
+  if (bucket < SUB_BUCKETS)
+    return bucket;
+  unsigned shift = static_cast<unsigned>(bucket / SUB_BUCKETS) - 1;
+  uint64_t base = (bucket % SUB_BUCKETS) + SUB_BUCKETS;
+  return ((base + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns) {
+  buckets_[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+
+  uint64_t seen = min_.load(std::memory_order_relaxed);
+  while (ns < seen &&
+         !min_.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {
+  }
+  seen = max_.load(std::memory_order_relaxed);
+  while (ns > seen &&
+         !max_.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {
+  }
+}
+
+uint64_t LatencyHistogram::min() const {
+  return count() == 0 ? 0 : min_.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentile(double q) const {
+  // Summed from the buckets rather than taken from count_, so a record()
+  // racing with this call cannot leave the target out of reach.
+  uint64_t total = 0;
+  for (const auto &b : buckets_)
+    total += b.load(std::memory_order_relaxed);
+  if (total == 0)
+    return 0;
+
+  auto target = static_cast<uint64_t>(
+      std::ceil(std::clamp(q, 0.0, 1.0) * static_cast<double>(total)));
+  target = std::max<uint64_t>(target, 1);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < BUCKETS; ++i) {
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if (seen >= target)
+      return std::min(bucket_top(i), max());
+  }
+  return max();
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Latency histogram with HDR-style log-linear buckets: every power of two
+// is split into 32 linear sub-buckets, so a reported value is within 1/32
+// (about 3%) of the recorded one, from single nanoseconds up to minutes,
+// in fixed memory. Longer values are clamped into the top bucket.
+// Recording is a few relaxed atomic operations and safe from any thread.
+class LatencyHistogram {
+public:
+  void record(uint64_t ns);
+
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  uint64_t min() const;
+  uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+  // The value at or below which a fraction `q` (0 to 1) of the recorded
+  // values fall, as the top of the bucket it lands in. 0 when empty.
+  uint64_t percentile(double q) const;
+
+private:
+  static constexpr unsigned SUB_BUCKET_BITS = 5;
+  static constexpr uint64_t SUB_BUCKETS = uint64_t{1} << SUB_BUCKET_BITS;
+  // Shift of the widest bucket range; 2^(32 + 6) ns is about 4.5 minutes.
+  static constexpr unsigned MAX_SHIFT = 32;
+  static constexpr size_t BUCKETS = (MAX_SHIFT + 2) * SUB_BUCKETS;
+
+  static size_t bucket_of(uint64_t ns);
+  static uint64_t bucket_top(size_t bucket);
+
+  std::array<std::atomic<uint64_t>, BUCKETS> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> min_{UINT64_MAX};
+  std::atomic<uint64_t> max_{0};
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "codec.h"
+#include "perf_counters.h"
+#include "process.h"
+#include "stats.h"
+#include "trace.h"
+
+// Hooks the conversion paths use to report their work to whichever of
+// options.stats, options.trace and options.perf are set. With none set
+// they do not even read the clock.
+
+// Books the lifetime of the scope as one `phase` span.
+class PhaseTimer {
+  using clock = std::chrono::steady_clock;
+
+  const ProcessOptions &options_;
+  Phase phase_;
+  uint64_t bytes_;
+  clock::time_point start_;
+  PerfCounters::Reading counters_;
+
+  bool active() const {
+    return options_.stats || options_.trace || options_.perf;
+  }
+
+public:
+  PhaseTimer(const ProcessOptions &options, Phase phase, uint64_t bytes = 0)
+      : options_(options), phase_(phase), bytes_(bytes) {
+    if (active())
+      start_ = clock::now();
+    // Read last and booked first, so the timing stays out of the counts.
+    if (options_.perf)
+      counters_ = options_.perf->read();
+  }
+  ~PhaseTimer() {
+    if (!active())
+      return;
+    if (options_.perf)
+      options_.perf->add_phase(phase_, counters_, bytes_);
+    auto end = clock::now();
+    if (options_.stats)
+      options_.stats->add_phase(phase_, end - start_, bytes_);
+    if (options_.trace)
+      options_.trace->phase(phase_, start_, end, bytes_);
+  }
+
+  PhaseTimer(const PhaseTimer &) = delete;
+  PhaseTimer &operator=(const PhaseTimer &) = delete;
+};
+
+// Runs `fn` inside a PhaseTimer and passes its result through, for timing
+// steps whose result is needed after the timed scope.
+template <typename Fn>
+decltype(auto) timed(const ProcessOptions &options, Phase phase, Fn &&fn) {
+  PhaseTimer timer(options, phase);
+  return fn();
+}
+
+// Runs `decode`, which returns the number of bytes it produced, and books
+// it as one block of `type` under the Decode phase.
+template <typename Decode>
+size_t timed_decode(const ProcessOptions &options, CompressionType type,
+                    GameMode mode, uint64_t compressed, Decode &&decode) {
+  if (!options.stats && !options.trace && !options.perf)
+    return decode();
+  auto start = std::chrono::steady_clock::now();
+  PerfCounters::Reading counters;
+  if (options.perf)
+    counters = options.perf->read();
+  size_t decoded = decode();
+  if (options.perf)
+    options.perf->add_decode(type, mode, counters, decoded);
+  auto end = std::chrono::steady_clock::now();
+  if (options.stats) {
+    options.stats->add_phase(Phase::Decode, end - start, decoded);
+    options.stats->add_decode(type, mode, compressed, decoded, end - start);
+  }
+  if (options.trace)
+    options.trace->block(type, mode, start, end, compressed, decoded);
+  return decoded;
+}
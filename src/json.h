@@ -0,0 +1,39 @@
+#pragma once
+
+#include <format>
+#include <string>
+#include <string_view>
+
+// Quotes and escapes `text` as a JSON string literal. Bytes outside ASCII
+// are passed through, so UTF-8 paths stay readable.
+inline std::string json_quote(std::string_view text) {
+  std::string out;
+  out.reserve(text.size() + 2);
+  out += '"';
+  for (char c : text) {
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20)
+        out += std::format("\\u{:04x}", static_cast<unsigned char>(c));
+      else
+        out += c;
+    }
+  }
+  out += '"';
+  return out;
+}
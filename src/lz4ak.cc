@@ -0,0 +1,172 @@
+#include "lz4ak.h"
+
+#include <cstring>
+#include <utility>
+
+namespace {
+
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t WILD_COPY = 16;
+
+// Reads the 0xFF-continued length extension. Returns false if the input
+// runs out before the terminating byte or the length cannot fit in size_t.
+bool read_extra_length(const uint8_t *&ip, const uint8_t *iend,
+                       size_t &length) {
+  uint8_t b;
+  do {
+    if (ip >= iend)
+      return false;
+    b = *ip++;
+    if (length > SIZE_MAX - b)
+      return false;
+    length += b;
+  } while (b == 0xFF);
+  return true;
+}
+
+void copy_match(uint8_t *op, size_t offset, size_t length,
+                const uint8_t *oend) {
+  const uint8_t *match = op - offset;
+  uint8_t *copy_end = op + length;
+
+  if (offset >= WILD_COPY &&
+      static_cast<size_t>(oend - copy_end) >= WILD_COPY) {
+    // Source and destination never overlap within one 16-byte step, so
+    // this may overshoot `length` but stays inside `dst`.
+    do {
+      std::memcpy(op, match, WILD_COPY);
+      op += WILD_COPY;
+      match += WILD_COPY;
+    } while (op < copy_end);
+    return;
+  }
+
+  while (op < copy_end)
+    *op++ = *match++;
+}
+
+// Walks the sequences of an LZ4 or LZ4AK block; `literal_shift` says where
+// the token keeps the literal length (4 for LZ4, 0 for LZ4AK). When `out`
+// is set it receives the block converted to the other format: both only
+// differ in token nibble order and offset byte order. Returns the decoded
+// size the block would produce, or -1 if it is not a well-formed sequence
+// stream.
+int64_t walk_sequences(std::span<const uint8_t> block, uint8_t *out,
+                       unsigned literal_shift) {
+  const uint8_t *ip = block.data();
+  const uint8_t *const iend = ip + block.size();
+  uint64_t decoded = 0;
+
+  while (ip < iend) {
+    const uint8_t token = *ip;
+    if (out)
+      out[ip - block.data()] =
+          static_cast<uint8_t>((token << 4) | (token >> 4));
+    ++ip;
+
+    size_t literal_len = (token >> literal_shift) & 0x0F;
+    if (literal_len == 0x0F && !read_extra_length(ip, iend, literal_len))
+      return -1;
+    if (literal_len > static_cast<size_t>(iend - ip))
+      return -1;
+    ip += literal_len;
+    decoded += literal_len;
+
+    if (ip == iend)
+      break;
+
+    if (iend - ip < 2)
+      return -1;
+    if (out)
+      std::swap(out[ip - block.data()], out[ip - block.data() + 1]);
+    ip += 2;
+
+    size_t match_len = (token >> (4 - literal_shift)) & 0x0F;
+    if (match_len == 0x0F && !read_extra_length(ip, iend, match_len))
+      return -1;
+    decoded += match_len + MIN_MATCH;
+  }
+  // Callers report sizes as int, like the LZ4 API.
+  if (decoded > INT32_MAX)
+    return -1;
+  return static_cast<int64_t>(decoded);
+}
+
+} // namespace
+
+bool lz4ak_from_lz4(std::span<uint8_t> block) {
+  return walk_sequences(block, block.data(), 4) >= 0;
+}
+
+int lz4_from_lz4ak(std::span<uint8_t> block) {
+  if (block.size() > INT32_MAX)
+    return -1;
+  return static_cast<int>(walk_sequences(block, block.data(), 0));
+}
+
+int lz4ak_decoded_size(std::span<const uint8_t> block) {
+  if (block.size() > INT32_MAX)
+    return -1;
+  return static_cast<int>(walk_sequences(block, nullptr, 0));
+}
+
+int lz4ak_decompress_safe(std::span<const uint8_t> src,
+                          std::span<uint8_t> dst) {
+  if (src.size() > INT32_MAX || dst.size() > INT32_MAX)
+    return -1;
+
+  const uint8_t *ip = src.data();
+  const uint8_t *const iend = ip + src.size();
+  uint8_t *op = dst.data();
+  uint8_t *const ostart = op;
+  uint8_t *const oend = op + dst.size();
+
+  auto error_at = [&] { return -static_cast<int>(ip - src.data()) - 1; };
+
+  while (ip < iend) {
+    const uint8_t token = *ip++;
+
+    size_t literal_len = token & 0x0F;
+    if (literal_len == 0x0F && !read_extra_length(ip, iend, literal_len))
+      return error_at();
+
+    if (literal_len > static_cast<size_t>(iend - ip) ||
+        literal_len > static_cast<size_t>(oend - op))
+      return error_at();
+
+    if (literal_len <= WILD_COPY &&
+        static_cast<size_t>(iend - ip) >= WILD_COPY &&
+        static_cast<size_t>(oend - op) >= WILD_COPY) {
+      std::memcpy(op, ip, WILD_COPY);
+    } else if (literal_len != 0) {
+      // An empty dst has no buffer, and memcpy must not see null.
+      std::memcpy(op, ip, literal_len);
+    }
+    ip += literal_len;
+    op += literal_len;
+
+    // The last sequence of a block carries literals only.
+    if (ip == iend)
+      break;
+
+    if (iend - ip < 2)
+      return error_at();
+    const size_t offset = (static_cast<size_t>(ip[0]) << 8) | ip[1];
+    ip += 2;
+    if (offset == 0 || offset > static_cast<size_t>(op - ostart))
+      return error_at();
+
+    size_t match_len = token >> 4;
+    if (match_len == 0x0F && !read_extra_length(ip, iend, match_len))
+      return error_at();
+    match_len += MIN_MATCH;
+
+    if (match_len > static_cast<size_t>(oend - op))
+      return error_at();
+
+    copy_match(op, offset, match_len, oend);
+    op += match_len;
+  }
+
+  return static_cast<int>(op - ostart);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+// Arknights ships LZ4 blocks with both nibbles of every token swapped
+// (literal length in the low nibble, match length in the high one) and
+// with match offsets stored big-endian. Everything else is plain LZ4.
+
+// Decodes an LZ4AK block straight into `dst` in a single pass, without
+// copying or patching the input first. Like LZ4_decompress_safe it never
+// reads past `src` or writes past `dst`, and returns the number of bytes
+// produced or a negative value if the block is malformed.
+int lz4ak_decompress_safe(std::span<const uint8_t> src, std::span<uint8_t> dst);
+
+// Rewrites a standard LZ4 block into LZ4AK in place: swaps each token's
+// nibbles and byte-swaps each match offset. Returns false (leaving the
+// block partially rewritten) if the block is not well-formed LZ4.
+bool lz4ak_from_lz4(std::span<uint8_t> block);
+
+// The inverse of lz4ak_from_lz4: rewrites an LZ4AK block into standard LZ4
+// in place. Returns the number of bytes the block decodes to, or a negative
+// value if it is malformed.
+int lz4_from_lz4ak(std::span<uint8_t> block);
+
+// Number of bytes an LZ4AK block decodes to, found by walking its sequence
+// lengths without producing any output. Negative if it is malformed.
+int lz4ak_decoded_size(std::span<const uint8_t> block);
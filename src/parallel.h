@@ -0,0 +1,123 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+inline unsigned resolve_thread_count(unsigned requested) {
+  if (requested != 0)
+    return requested;
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Runs fn(i) for every i in [0, count) on up to `threads` threads, handing
+// out indices in ascending order. With one thread (or one item) everything
+// runs inline on the caller. The first exception stops further indices
+// from being handed out and is rethrown once all workers have finished.
+template <typename Fn>
+void parallel_for(size_t count, unsigned threads, Fn &&fn) {
+  threads = static_cast<unsigned>(
+      std::min<size_t>(resolve_thread_count(threads), count));
+  if (threads <= 1) {
+    for (size_t i = 0; i < count; ++i)
+      fn(i);
+    return;
+  }
+
+  std::atomic<size_t> next{0};
+  std::atomic<bool> failed{false};
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  auto worker = [&] {
+    while (!failed.load(std::memory_order_relaxed)) {
+      size_t i = next.fetch_add(1, std::memory_order_relaxed);
+      if (i >= count)
+        return;
+      try {
+        fn(i);
+      } catch (...) {
+        std::lock_guard lock(error_mutex);
+        if (!error)
+          error = std::current_exception();
+        failed = true;
+      }
+    }
+  };
+
+  {
+    std::vector<std::jthread> workers;
+    workers.reserve(threads - 1);
+    for (unsigned t = 1; t < threads; ++t)
+      workers.emplace_back(worker);
+    worker();
+  }
+
+  if (error)
+    std::rethrow_exception(error);
+}
+
+// Fixed set of worker threads running submitted tasks in FIFO order. The
+// threads live as long as the pool, so thread_local state such as the
+// per-thread LZMA/LZHAM decoders stays warm from one task to the next.
+// Tasks must not throw. The destructor runs every queued task before it
+// joins the workers.
+class ThreadPool {
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::deque<std::function<void()>> tasks_;
+  bool stopping_ = false;
+  std::vector<std::jthread> threads_;
+
+  void work() {
+    for (;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock lock(mutex_);
+        wake_.wait(lock, [&] { return stopping_ || !tasks_.empty(); });
+        if (tasks_.empty())
+          return;
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+    }
+  }
+
+public:
+  explicit ThreadPool(unsigned threads) {
+    threads = resolve_thread_count(threads);
+    threads_.reserve(threads);
+    for (unsigned t = 0; t < threads; ++t)
+      threads_.emplace_back([this] { work(); });
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard lock(mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    threads_.clear();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t size() const { return threads_.size(); }
+
+  void submit(std::function<void()> task) {
+    {
+      std::lock_guard lock(mutex_);
+      tasks_.push_back(std::move(task));
+    }
+    wake_.notify_one();
+  }
+};
@@ -0,0 +1,268 @@
+#include "perf_counters.h"
+
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <string_view>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+std::atomic<uint64_t> next_counters_id{1};
+
+#ifdef __linux__
+
+constexpr std::array<uint64_t, PerfCounters::COUNTER_COUNT> EVENTS = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+// Counts `event` on the calling thread, on whatever CPU it runs on, as a
+// member of `group` (or a new group's leader when -1).
+int open_event(uint64_t event, int group, bool user_only) {
+  perf_event_attr attr{};
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = event;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.exclude_kernel = user_only;
+  attr.exclude_hv = 1;
+  return static_cast<int>(
+      syscall(SYS_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC));
+}
+
+std::string describe_open_error(int err) {
+  switch (err) {
+  case EACCES:
+  case EPERM:
+    return "perf_event_open not permitted (see "
+           "/proc/sys/kernel/perf_event_paranoid)";
+  case ENOENT:
+  case ENODEV:
+  case EOPNOTSUPP:
+    return "no hardware counters on this machine";
+  case ENOSYS:
+    return "perf_event_open is not supported by this kernel";
+  default:
+    return std::format("perf_event_open failed: {}", std::strerror(err));
+  }
+}
+
+#endif
+
+} // namespace
+
+struct PerfCounters::ThreadGroup {
+  uint64_t owner = 0;
+  // fds[0] leads the group; a read of it returns every open member.
+  std::array<int, COUNTER_COUNT> fds{-1, -1, -1, -1};
+  // Position of each counter in a group read, or -1 when not open.
+  std::array<int, COUNTER_COUNT> position{-1, -1, -1, -1};
+  size_t opened = 0;
+
+  void close() {
+#ifdef __linux__
+    for (int fd : fds)
+      if (fd >= 0)
+        ::close(fd);
+#endif
+    fds.fill(-1);
+    position.fill(-1);
+    opened = 0;
+  }
+  ~ThreadGroup() { close(); }
+};
+
+PerfCounters::PerfCounters() : id_(next_counters_id++) {
+#ifdef __linux__
+  // Also settles user_only_ before any worker opens its group, so all
+  // threads count the same thing.
+  local();
+#else
+  disable("hardware counters are only supported on Linux");
+#endif
+}
+
+std::string PerfCounters::error() const {
+  std::lock_guard lock(mutex_);
+  return error_;
+}
+
+void PerfCounters::disable(std::string reason) {
+  std::lock_guard lock(mutex_);
+  if (error_.empty())
+    error_ = std::move(reason);
+  disabled_.store(true, std::memory_order_relaxed);
+}
+
+PerfCounters::ThreadGroup &PerfCounters::local() {
+  thread_local ThreadGroup group;
+  if (group.owner != id_) {
+    group.close();
+    group.owner = id_;
+    if (available())
+      open(group);
+  }
+  return group;
+}
+
+bool PerfCounters::open(ThreadGroup &group) {
+#ifdef __linux__
+  bool user_only = user_only_.load(std::memory_order_relaxed);
+  int leader = open_event(EVENTS[0], -1, user_only);
+  // The default perf_event_paranoid level only lets unprivileged
+  // processes count their own user-space work.
+  if (leader < 0 && (errno == EACCES || errno == EPERM) && !user_only) {
+    user_only = true;
+    leader = open_event(EVENTS[0], -1, user_only);
+    if (leader >= 0)
+      user_only_.store(true, std::memory_order_relaxed);
+  }
+  if (leader < 0) {
+    disable(describe_open_error(errno));
+    return false;
+  }
+  group.fds[0] = leader;
+  group.position[0] = 0;
+  group.opened = 1;
+  for (size_t i = 1; i < COUNTER_COUNT; ++i) {
+    int fd = open_event(EVENTS[i], leader, user_only);
+    if (fd < 0) {
+      missing_.fetch_or(1u << i, std::memory_order_relaxed);
+      continue;
+    }
+    group.fds[i] = fd;
+    group.position[i] = static_cast<int>(group.opened++);
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+PerfCounters::Reading PerfCounters::read() {
+  Reading r;
+#ifdef __linux__
+  ThreadGroup &group = local();
+  if (group.fds[0] < 0)
+    return r;
+  // nr, time_enabled, time_running, then one value per member.
+  std::array<uint64_t, 3 + COUNTER_COUNT> buf{};
+  ssize_t got = ::read(group.fds[0], buf.data(), sizeof(buf));
+  if (got < static_cast<ssize_t>((3 + group.opened) * sizeof(uint64_t)))
+    return r;
+  r.enabled_ns = buf[1];
+  r.running_ns = buf[2];
+  for (size_t i = 0; i < COUNTER_COUNT; ++i)
+    if (group.position[i] >= 0)
+      r.values[i] = buf[3 + group.position[i]];
+  r.valid = true;
+#endif
+  return r;
+}
+
+bool PerfCounters::since(const Reading &start, Counts &counts) {
+  if (!start.valid)
+    return false;
+  Reading end = read();
+  if (!end.valid)
+    return false;
+  counts.fill(0);
+  // With more events than the PMU has counters, the kernel time-slices
+  // them; scale up by the share of the span the group was on the PMU.
+  uint64_t enabled = end.enabled_ns - start.enabled_ns;
+  uint64_t running = end.running_ns - start.running_ns;
+  if (running == 0)
+    return true;
+  double scale = 1.0;
+  if (running < enabled) {
+    scale = static_cast<double>(enabled) / static_cast<double>(running);
+    scaled_.fetch_add(1, std::memory_order_relaxed);
+  }
+  for (size_t i = 0; i < COUNTER_COUNT; ++i)
+    counts[i] = static_cast<uint64_t>(
+        static_cast<double>(end.values[i] - start.values[i]) * scale);
+  return true;
+}
+
+void PerfCounters::Totals::add(const Counts &counts, uint64_t span_bytes) {
+  spans.fetch_add(1, std::memory_order_relaxed);
+  bytes.fetch_add(span_bytes, std::memory_order_relaxed);
+  for (size_t i = 0; i < COUNTER_COUNT; ++i)
+    values[i].fetch_add(counts[i], std::memory_order_relaxed);
+}
+
+void PerfCounters::add_phase(Phase phase, const Reading &start,
+                             uint64_t bytes) {
+  Counts counts;
+  if (since(start, counts))
+    phases_[static_cast<size_t>(phase)].add(counts, bytes);
+}
+
+void PerfCounters::add_decode(CompressionType type, GameMode mode,
+                              const Reading &start, uint64_t decoded) {
+  Counts counts;
+  if (!since(start, counts))
+    return;
+  phases_[static_cast<size_t>(Phase::Decode)].add(counts, decoded);
+  if (size_t slot = codec_slot(type, mode); slot != CODEC_SLOTS)
+    codecs_[slot].add(counts, decoded);
+}
+
+std::string PerfCounters::text() const {
+  if (!available())
+    return std::format("perf counters unavailable: {}\n", error());
+
+  uint32_t missing = missing_.load(std::memory_order_relaxed);
+  auto row = [&](std::string_view name, const Totals &t) {
+    uint64_t bytes = t.bytes.load();
+    auto value = [&](Counter c) { return static_cast<double>(t.values[c]); };
+    auto has = [&](Counter c) { return (missing & (1u << c)) == 0; };
+    // Per byte, or per KiB for the rarer events; "-" when not counted.
+    auto cell = [&](Counter c, double unit) {
+      if (bytes == 0 || !has(c))
+        return std::string("-");
+      return std::format("{:.2f}", value(c) * unit / bytes);
+    };
+    std::string ipc =
+        value(Cycles) == 0 || !has(Instructions)
+            ? std::string("-")
+            : std::format("{:.2f}", value(Instructions) / value(Cycles));
+    return std::format("{:<12}{:>10}{:>16}{:>10.1f}{:>10}{:>10}{:>7}{:>12}"
+                       "{:>12}\n",
+                       name, t.spans.load(), bytes, value(Cycles) / 1e6,
+                       cell(Cycles, 1), cell(Instructions, 1), ipc,
+                       cell(CacheMisses, 1024), cell(BranchMisses, 1024));
+  };
+  auto header = [](std::string_view what) {
+    return std::format("{:<12}{:>10}{:>16}{:>10}{:>10}{:>10}{:>7}{:>12}"
+                       "{:>12}\n",
+                       what, "spans", "bytes", "Mcycles", "cyc/B", "ins/B",
+                       "IPC", "cmiss/KiB", "bmiss/KiB");
+  };
+
+  std::string out =
+      std::format("perf counters ({}):\n",
+                  user_only_.load() ? "user space only" : "user and kernel");
+  out += header("phase");
+  for (size_t i = 0; i < PHASE_COUNT; ++i)
+    if (phases_[i].spans != 0)
+      out += row(phase_name(static_cast<Phase>(i)), phases_[i]);
+  out += header("codec");
+  for (size_t i = 0; i < CODEC_SLOTS; ++i) {
+    if (codecs_[i].spans == 0)
+      continue;
+    auto [type, mode] = slot_codec(i);
+    out += row(compression_name(type, mode), codecs_[i]);
+  }
+  if (uint64_t scaled = scaled_.load(); scaled != 0)
+    out += std::format("{} spans shared the PMU with other events; their "
+                       "counts are scaled estimates\n",
+                       scaled);
+  return out;
+}
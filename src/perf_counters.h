@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "codec.h"
+#include "stats.h"
+
+// Hardware performance counters (cycles, instructions, cache misses and
+// branch misses) booked per phase and per decoding codec, so the cost of
+// each codec per decoded byte can be told apart from I/O. Every thread
+// opens its own perf_event_open group on first use and the counters only
+// count that thread, so spans on parallel workers do not mix. Counters the
+// kernel does not allow (perf_event_paranoid, containers, VMs without a
+// PMU) turn the whole set off; available() then says so and every call is
+// a no-op. Linux only.
+class PerfCounters {
+public:
+  enum Counter : uint8_t { Cycles, Instructions, CacheMisses, BranchMisses };
+  static constexpr size_t COUNTER_COUNT = 4;
+
+  // Running totals of the calling thread's counters.
+  struct Reading {
+    std::array<uint64_t, COUNTER_COUNT> values{};
+    uint64_t enabled_ns = 0;
+    uint64_t running_ns = 0;
+    bool valid = false;
+  };
+
+  // Opens the counters on the calling thread, so available() is known
+  // before any work starts.
+  PerfCounters();
+
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  bool available() const { return !disabled_.load(std::memory_order_relaxed); }
+  // Why the counters are off, for the warning.
+  std::string error() const;
+
+  Reading read();
+
+  // Book what the calling thread counted since `start` (a read() on the
+  // same thread) as one span of `phase`, or as one block of a codec and a
+  // span of Phase::Decode.
+  void add_phase(Phase phase, const Reading &start, uint64_t bytes);
+  void add_decode(CompressionType type, GameMode mode, const Reading &start,
+                  uint64_t decoded);
+
+  // Multi-line table of counters per byte, per phase and per codec.
+  std::string text() const;
+
+private:
+  using Counts = std::array<uint64_t, COUNTER_COUNT>;
+  struct Totals {
+    std::atomic<uint64_t> spans{0};
+    std::atomic<uint64_t> bytes{0};
+    std::array<std::atomic<uint64_t>, COUNTER_COUNT> values{};
+
+    void add(const Counts &counts, uint64_t span_bytes);
+  };
+  struct ThreadGroup;
+
+  ThreadGroup &local();
+  bool open(ThreadGroup &group);
+  void disable(std::string reason);
+  // Counts since `start` on this thread; false if either read failed.
+  bool since(const Reading &start, Counts &counts);
+
+  const uint64_t id_;
+  std::atomic<bool> disabled_{false};
+  // Set once the kernel refused to count kernel-mode events, after which
+  // every thread counts user space only.
+  std::atomic<bool> user_only_{false};
+  // Counters that some thread could not open, as a bit mask.
+  std::atomic<uint32_t> missing_{0};
+  // Spans that shared the PMU with other events and were scaled up.
+  std::atomic<uint64_t> scaled_{0};
+  mutable std::mutex mutex_;
+  std::string error_;
+  std::array<Totals, PHASE_COUNT> phases_;
+  std::array<Totals, CODEC_SLOTS> codecs_;
+};
@@ -0,0 +1,1070 @@
+#include "process.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <print>
+#include <span>
+#include <string>
+
+#include <lz4.h>
+
+#include "bundle.h"
+#include "byte_buffer.h"
+#include "file_io.h"
+#include "instrument.h"
+#include "json.h"
+#include "lz4ak.h"
+#include "parallel.h"
+#include "progress.h"
+#include "result_cache.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// One file's share of the run's progress. Blocks advance it by their
+// compressed size as they finish; whatever they did not cover (header,
+// block info, or blocks a failure left behind) is added when the file is
+// done, so each file counts exactly its size.
+class FileProgress {
+  ProgressReporter *reporter_;
+  uint64_t size_;
+  std::atomic<uint64_t> reported_{0};
+
+public:
+  FileProgress(ProgressReporter *reporter, uint64_t size)
+      : reporter_(reporter), size_(size) {}
+  ~FileProgress() {
+    if (!reporter_)
+      return;
+    uint64_t reported = reported_.load(std::memory_order_relaxed);
+    reporter_->advance(size_ > reported ? size_ - reported : 0);
+    reporter_->file_done();
+  }
+
+  FileProgress(const FileProgress &) = delete;
+  FileProgress &operator=(const FileProgress &) = delete;
+
+  void block_done(uint64_t compressed_size) {
+    if (!reporter_)
+      return;
+    reporter_->advance(compressed_size);
+    reported_.fetch_add(compressed_size, std::memory_order_relaxed);
+  }
+};
+
+// Status lines go through the progress reporter when there is one, so they
+// land above its status line instead of through it.
+void print_status(const ProcessOptions &options, std::string_view line) {
+  if (options.quiet)
+    return;
+  if (options.progress)
+    options.progress->message(line);
+  else
+    std::cout << line << '\n';
+}
+
+// Positioned I/O booked under the Read and Write phases.
+void timed_read(const InputFile &input, uint64_t offset,
+                std::span<uint8_t> dst, const ProcessOptions &options) {
+  PhaseTimer timer(options, Phase::Read, dst.size());
+  input.read_at(offset, dst);
+}
+
+void timed_write(OutputFile &output, uint64_t offset,
+                 std::span<const uint8_t> src,
+                 const ProcessOptions &options) {
+  PhaseTimer timer(options, Phase::Write, src.size());
+  output.write_at(offset, src);
+}
+
+void process_file_mapped(const fs::path &input_path,
+                         const fs::path &output_path,
+                         const ProcessOptions &options,
+                         FileProgress &progress) {
+  MappedFile input =
+      timed(options, Phase::Read, [&] { return MappedFile(input_path); });
+  BinaryReader reader(input.data());
+
+  BundleHeader header =
+      timed(options, Phase::Header, [&] { return read_bundle_header(reader); });
+  reader.seek(block_info_offset(header));
+  auto raw_block_info = reader.get_span(header.compressed_blocks_info_size);
+  BundleDirectory dir = timed(options, Phase::BlockInfo, [&] {
+    return read_bundle_directory(header, raw_block_info);
+  });
+  const auto &blocks = dir.blocks;
+  const auto &nodes = dir.nodes;
+
+  reader.seek(data_offset(header));
+  std::vector<std::span<const uint8_t>> compressed_blocks(blocks.size());
+  for (size_t i = 0; i < blocks.size(); ++i)
+    compressed_blocks[i] = reader.get_span(blocks[i].compressed_size);
+
+  StoredLayout layout = timed(options, Phase::Rebuild,
+                              [&] { return plan_stored_layout(blocks); });
+  auto prefix = timed(options, Phase::Rebuild, [&] {
+    return build_stored_prefix(header, layout, nodes);
+  });
+  size_t data_offset = prefix.size();
+
+  MappedOutputFile output = timed(options, Phase::Write, [&] {
+    return MappedOutputFile(output_path, data_offset + layout.data_size);
+  });
+  auto out = output.data();
+  std::copy(prefix.begin(), prefix.end(), out.begin());
+  auto out_data = out.subspan(data_offset);
+
+  std::vector<size_t> decoded_sizes(blocks.size());
+
+  parallel_for(blocks.size(), options.threads, [&](size_t i) {
+    auto &old_blk = blocks[i];
+
+    size_t decoded = timed_decode(
+        options, old_blk.get_compression(), options.game_mode,
+        old_blk.compressed_size, [&] {
+          return decompress_block_into(
+              old_blk.get_compression(), compressed_blocks[i],
+              out_data.subspan(layout.slot_offsets[i],
+                               layout.blocks[i].uncompressed_size),
+              options.game_mode);
+        });
+    decoded_sizes[i] = decoded;
+    progress.block_done(old_blk.compressed_size);
+  });
+
+  {
+    PhaseTimer timer(options, Phase::Rebuild);
+    bool resized = close_slot_gaps(
+        layout, decoded_sizes, [&](size_t from, size_t to, size_t size) {
+          std::memmove(out_data.data() + to, out_data.data() + from, size);
+        });
+    if (resized) {
+      print_status(options, "Rebuilding header...");
+      prefix = build_stored_prefix(header, layout, nodes);
+      std::copy(prefix.begin(), prefix.end(), out.begin());
+    }
+  }
+
+  PhaseTimer timer(options, Phase::Write, data_offset + layout.data_size);
+  output.close(data_offset + layout.data_size);
+}
+
+// Chunk size for reads and writes of LZMA blocks decoded piecewise.
+constexpr size_t STREAM_CHUNK_SIZE = 256 << 10;
+
+// The header itself is a handful of short strings and fixed fields; this
+// is far more than any real bundle needs.
+constexpr size_t MAX_HEADER_SIZE = 4096;
+
+// Header, directory and block positions of a bundle read through
+// positioned reads, without touching the data section.
+struct BundleSource {
+  BundleHeader header;
+  BundleDirectory dir;
+  std::vector<uint64_t> src_offsets;
+};
+
+BundleSource read_bundle_source(InputFile &input,
+                                const ProcessOptions &options) {
+  BundleSource source;
+  ByteBuffer header_bytes(std::min<uint64_t>(input.size(), MAX_HEADER_SIZE));
+  timed_read(input, 0, header_bytes, options);
+  BinaryReader reader(header_bytes);
+  source.header =
+      timed(options, Phase::Header, [&] { return read_bundle_header(reader); });
+  const BundleHeader &header = source.header;
+
+  ByteBuffer raw_block_info(header.compressed_blocks_info_size);
+  uint64_t info_offset = block_info_offset(header);
+  if (info_offset + raw_block_info.size() > input.size())
+    throw std::out_of_range("block info runs past the end of the file");
+  timed_read(input, info_offset, raw_block_info, options);
+  source.dir = timed(options, Phase::BlockInfo, [&] {
+    return read_bundle_directory(header, raw_block_info);
+  });
+  const auto &blocks = source.dir.blocks;
+
+  uint64_t data_start = data_offset(header);
+  source.src_offsets.resize(blocks.size());
+  uint64_t src_cursor = data_start;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    source.src_offsets[i] = src_cursor;
+    src_cursor += blocks[i].compressed_size;
+  }
+  if (src_cursor > input.size())
+    throw std::out_of_range(
+        std::format("blocks end at {} but the file has {} bytes", src_cursor,
+                    input.size()));
+  return source;
+}
+
+// Bounded-memory variant: nothing is mapped, and each of at most N workers
+// owns one compressed and one decoded buffer sized for the largest block.
+// Blocks are read with positioned reads and written at their precomputed
+// slot, so peak memory depends on block sizes, not on the bundle size.
+void process_file_streaming(const fs::path &input_path,
+                            const fs::path &output_path,
+                            const ProcessOptions &options,
+                            FileProgress &progress) {
+  InputFile input(input_path);
+  BundleSource source = read_bundle_source(input, options);
+  const BundleHeader &header = source.header;
+  const auto &blocks = source.dir.blocks;
+  const auto &nodes = source.dir.nodes;
+  const auto &src_offsets = source.src_offsets;
+
+  StoredLayout layout = timed(options, Phase::Rebuild,
+                              [&] { return plan_stored_layout(blocks); });
+
+  // Most blocks are read and decoded whole. LZMA blocks whose dictionary
+  // window plus two chunk buffers is smaller than that (typically the one
+  // huge block of an LZMA bundle) are decoded in chunks instead.
+  std::vector<size_t> lzma_windows(blocks.size());
+  size_t max_compressed = 0;
+  size_t max_slot = 0;
+  size_t max_window = 0;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    size_t compressed = blocks[i].compressed_size;
+    size_t slot = layout.blocks[i].uncompressed_size;
+    if (blocks[i].get_compression() == CompressionType::Lzma &&
+        compressed >= LZMA_PROPS_SIZE &&
+        compressed + slot > 2 * STREAM_CHUNK_SIZE) {
+      uint8_t props[LZMA_PROPS_SIZE];
+      timed_read(input, src_offsets[i], props, options);
+      size_t window = LzmaDecoder::window_size_for(props, slot);
+      if (window + 2 * STREAM_CHUNK_SIZE < compressed + slot) {
+        lzma_windows[i] = window;
+        max_window = std::max(max_window, window);
+        continue;
+      }
+    }
+    max_compressed = std::max(max_compressed, compressed);
+    max_slot = std::max(max_slot, slot);
+  }
+  size_t chunk_size = max_window != 0 ? STREAM_CHUNK_SIZE : 0;
+
+  uint64_t per_worker = std::max<uint64_t>(
+      max_compressed + max_slot + max_window + 2 * chunk_size, 1);
+  if (options.max_memory < per_worker)
+    std::println(stderr,
+                 "Warning: --max-memory {} is below the {} bytes needed for "
+                 "the largest block",
+                 options.max_memory, per_worker);
+  size_t workers = static_cast<size_t>(std::clamp<uint64_t>(
+      options.max_memory / per_worker, 1,
+      resolve_thread_count(options.threads)));
+
+  auto prefix = timed(options, Phase::Rebuild, [&] {
+    return build_stored_prefix(header, layout, nodes);
+  });
+  size_t data_offset = prefix.size();
+
+  OutputFile output(output_path);
+  timed_write(output, 0, prefix, options);
+
+  std::vector<size_t> decoded_sizes(blocks.size());
+  std::atomic<size_t> next_block{0};
+  std::atomic<bool> failed{false};
+
+  parallel_for(workers, workers, [&](size_t) {
+    ByteBuffer src_buf(max_compressed);
+    ByteBuffer dst_buf(max_slot);
+    ByteBuffer in_chunk(chunk_size);
+    ByteBuffer out_chunk(chunk_size);
+    try {
+      for (size_t i; !failed && (i = next_block++) < blocks.size();) {
+        auto &old_blk = blocks[i];
+
+        if (lzma_windows[i] != 0) {
+          uint8_t props[LZMA_PROPS_SIZE];
+          timed_read(input, src_offsets[i], props, options);
+          uint64_t in_pos = src_offsets[i] + LZMA_PROPS_SIZE;
+          uint64_t in_end = src_offsets[i] + old_blk.compressed_size;
+          uint64_t out_pos = data_offset + layout.slot_offsets[i];
+          size_t size = layout.blocks[i].uncompressed_size;
+
+          // Booked as one decode, including the chunk reads and writes
+          // it interleaves.
+          timed_decode(options, CompressionType::Lzma, options.game_mode,
+                       old_blk.compressed_size, [&] {
+                         thread_lzma_decoder().decode_chunked(
+                             props, size, in_chunk, out_chunk,
+                             [&](std::span<uint8_t> buf) {
+                               size_t n = static_cast<size_t>(
+                                   std::min<uint64_t>(buf.size(),
+                                                      in_end - in_pos));
+                               input.read_at(in_pos, buf.first(n));
+                               in_pos += n;
+                               return n;
+                             },
+                             [&](std::span<const uint8_t> out) {
+                               output.write_at(out_pos, out);
+                               out_pos += out.size();
+                             });
+                         return size;
+                       });
+          decoded_sizes[i] = size;
+          progress.block_done(old_blk.compressed_size);
+          continue;
+        }
+
+        auto src = src_buf.span().first(old_blk.compressed_size);
+        timed_read(input, src_offsets[i], src, options);
+
+        size_t decoded = timed_decode(
+            options, old_blk.get_compression(), options.game_mode,
+            old_blk.compressed_size, [&] {
+              return decompress_block_into(
+                  old_blk.get_compression(), src,
+                  dst_buf.span().first(layout.blocks[i].uncompressed_size),
+                  options.game_mode);
+            });
+        timed_write(output, data_offset + layout.slot_offsets[i],
+                    dst_buf.span().first(decoded), options);
+        decoded_sizes[i] = decoded;
+        progress.block_done(old_blk.compressed_size);
+      }
+    } catch (...) {
+      failed = true;
+      throw;
+    }
+  });
+
+  {
+    PhaseTimer timer(options, Phase::Rebuild);
+    ByteBuffer move_buf(std::max<size_t>(max_slot, STREAM_CHUNK_SIZE));
+    bool resized = close_slot_gaps(
+        layout, decoded_sizes, [&](size_t from, size_t to, size_t size) {
+          // Blocks only ever slide towards the front, so copying front to
+          // back in bounded chunks never clobbers bytes still to be moved.
+          for (size_t done = 0; done < size;) {
+            auto chunk = move_buf.span().first(
+                std::min(move_buf.size(), size - done));
+            output.read_at(data_offset + from + done, chunk);
+            output.write_at(data_offset + to + done, chunk);
+            done += chunk.size();
+          }
+        });
+    if (resized) {
+      print_status(options, "Rebuilding header...");
+      prefix = build_stored_prefix(header, layout, nodes);
+      output.write_at(0, prefix);
+    }
+  }
+
+  PhaseTimer timer(options, Phase::Write);
+  output.resize(data_offset + layout.data_size);
+  output.close();
+}
+
+// Decoded blocks shared between the output chunks that overlap them. The
+// first chunk to need a block decodes it; later ones wait for that result.
+// A block is dropped once every chunk that overlaps it has taken its
+// bytes, and since chunks are handed out in order only the blocks around
+// the chunks in flight are ever resident.
+class DecodedBlockCache {
+  std::mutex mutex_;
+  std::vector<std::shared_future<std::shared_ptr<const ByteBuffer>>> slots_;
+  std::vector<size_t> users_;
+
+public:
+  explicit DecodedBlockCache(std::vector<size_t> users)
+      : slots_(users.size()), users_(std::move(users)) {}
+
+  template <typename Decode>
+  std::shared_ptr<const ByteBuffer> get(size_t block, Decode &&decode) {
+    std::unique_lock lock(mutex_);
+    if (slots_[block].valid()) {
+      auto future = slots_[block];
+      lock.unlock();
+      return future.get();
+    }
+    std::promise<std::shared_ptr<const ByteBuffer>> promise;
+    slots_[block] = promise.get_future().share();
+    lock.unlock();
+    try {
+      auto decoded = std::make_shared<const ByteBuffer>(decode());
+      promise.set_value(decoded);
+      return decoded;
+    } catch (...) {
+      promise.set_exception(std::current_exception());
+      throw;
+    }
+  }
+
+  void release(size_t block) {
+    std::lock_guard lock(mutex_);
+    if (--users_[block] == 0)
+      slots_[block] = {};
+  }
+};
+
+// Re-encodes the decoded stream with options.output_codec (None writes
+// stored blocks), cut into options.chunk_size blocks, or along the input's
+// block boundaries when that is 0. Compressed sizes are only known once a
+// chunk is done, so workers compress chunks in parallel and append them in
+// order behind a prefix whose size is fixed up front: the block info is
+// written uncompressed, and its length depends only on the block and node
+// counts.
+void process_file_recompress(const fs::path &input_path,
+                             const fs::path &output_path,
+                             const ProcessOptions &options,
+                             FileProgress &progress) {
+  InputFile input(input_path);
+  BundleSource source = read_bundle_source(input, options);
+  const BundleHeader &header = source.header;
+  const auto &blocks = source.dir.blocks;
+  const auto &nodes = source.dir.nodes;
+
+  // Chunks are cut from the decoded stream, so every block's real decoded
+  // size is needed up front. LZ4AK blocks can come up short of the table
+  // and are measured by walking their sequences.
+  std::vector<uint64_t> decoded_sizes(blocks.size());
+  size_t max_compressed = 0;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    decoded_sizes[i] = blocks[i].get_compression() == CompressionType::None
+                           ? blocks[i].compressed_size
+                           : blocks[i].uncompressed_size;
+    max_compressed =
+        std::max<size_t>(max_compressed, blocks[i].compressed_size);
+  }
+  if (options.game_mode == GameMode::Arknights) {
+    parallel_for(blocks.size(), options.threads, [&](size_t i) {
+      if (blocks[i].get_compression() != CompressionType::Lzham)
+        return;
+      ByteBuffer src(blocks[i].compressed_size);
+      timed_read(input, source.src_offsets[i], src, options);
+      int size = timed(options, Phase::Rebuild,
+                       [&] { return lz4ak_decoded_size(src); });
+      if (size < 0)
+        throw std::runtime_error(std::format("Block {} is not valid LZ4AK", i));
+      decoded_sizes[i] = std::min<uint64_t>(size, decoded_sizes[i]);
+    });
+  }
+
+  std::vector<uint64_t> block_begin(blocks.size() + 1);
+  for (size_t i = 0; i < blocks.size(); ++i)
+    block_begin[i + 1] = block_begin[i] + decoded_sizes[i];
+  const uint64_t total = block_begin.back();
+
+  struct Chunk {
+    uint64_t begin;
+    uint64_t end;
+    // Blocks [first_block, last_block] hold the chunk's bytes.
+    size_t first_block;
+    size_t last_block;
+  };
+  std::vector<Chunk> chunks;
+  if (options.chunk_size == 0) {
+    for (size_t i = 0; i < blocks.size(); ++i)
+      chunks.push_back({block_begin[i], block_begin[i + 1], i, i});
+  } else {
+    size_t block = 0;
+    for (uint64_t begin = 0; begin < total; begin += options.chunk_size) {
+      uint64_t end = std::min(total, begin + options.chunk_size);
+      while (block_begin[block + 1] <= begin)
+        ++block;
+      size_t last = block;
+      while (block_begin[last + 1] < end)
+        ++last;
+      chunks.push_back({begin, end, block, last});
+    }
+  }
+
+  std::vector<size_t> users(blocks.size());
+  size_t max_decoded = 0;
+  size_t max_chunk = 0;
+  for (const auto &c : chunks) {
+    for (size_t i = c.first_block; i <= c.last_block; ++i)
+      ++users[i];
+    max_chunk = std::max<size_t>(max_chunk, c.end - c.begin);
+  }
+  for (uint64_t size : decoded_sizes)
+    max_decoded = std::max<size_t>(max_decoded, size);
+  if (max_chunk > LZ4_MAX_INPUT_SIZE &&
+      options.output_codec != CompressionType::None)
+    throw std::runtime_error(
+        std::format("Output block of {} bytes is too large; use --chunk-size",
+                    max_chunk));
+
+  // One decoded block (plus its compressed input) and one chunk with its
+  // compressed copy per worker.
+  uint64_t per_worker =
+      std::max<uint64_t>(max_compressed + max_decoded + 2 * max_chunk, 1);
+  size_t workers = resolve_thread_count(options.threads);
+  if (options.max_memory != 0)
+    workers = static_cast<size_t>(
+        std::clamp<uint64_t>(options.max_memory / per_worker, 1, workers));
+
+  std::vector<ArchiveBlockInfo> new_blocks(chunks.size());
+  auto make_prefix = [&](uint64_t data_size) {
+    PhaseTimer timer(options, Phase::Rebuild);
+    auto block_info = build_block_info(new_blocks, nodes);
+    auto prefix = build_header(header.version, header.unity_ver,
+                               header.unity_rev, FLAG_BLOCKS_AND_DIR_COMBINED,
+                               block_info.size(), data_size);
+    prefix.insert(prefix.end(), block_info.begin(), block_info.end());
+    return prefix;
+  };
+  size_t data_offset = make_prefix(0).size();
+
+  OutputFile output(output_path);
+  DecodedBlockCache cache(std::move(users));
+
+  auto decode = [&](size_t i) {
+    ByteBuffer src(blocks[i].compressed_size);
+    timed_read(input, source.src_offsets[i], src, options);
+    ByteBuffer dst(blocks[i].get_compression() == CompressionType::None
+                       ? blocks[i].compressed_size
+                       : blocks[i].uncompressed_size);
+    size_t decoded = timed_decode(
+        options, blocks[i].get_compression(), options.game_mode,
+        blocks[i].compressed_size, [&] {
+          return decompress_block_into(blocks[i].get_compression(), src, dst,
+                                       options.game_mode);
+        });
+    if (decoded != decoded_sizes[i])
+      throw std::runtime_error(std::format(
+          "Block {} decoded to {} bytes, expected {}", i, decoded,
+          decoded_sizes[i]));
+    dst.shrink(decoded);
+    progress.block_done(blocks[i].compressed_size);
+    return dst;
+  };
+
+  // Unity marks the blocks of chunk-based bundles as streamed, so loaders
+  // know they can read single blocks.
+  uint16_t block_flags = static_cast<uint16_t>(options.output_codec);
+  if (options.chunk_size != 0)
+    block_flags |= BLOCK_FLAG_STREAMED;
+
+  std::mutex write_mutex;
+  std::condition_variable write_turn;
+  size_t next_write = 0;
+  uint64_t out_cursor = data_offset;
+  std::atomic<size_t> next_chunk{0};
+  std::atomic<bool> failed{false};
+
+  parallel_for(workers, workers, [&](size_t) {
+    ByteBuffer chunk_buf;
+    try {
+      for (size_t c; !failed && (c = next_chunk++) < chunks.size();) {
+        const Chunk &chunk = chunks[c];
+        size_t chunk_size = static_cast<size_t>(chunk.end - chunk.begin);
+
+        // A chunk inside a single block is compressed straight from it;
+        // one spanning several is gathered first.
+        std::shared_ptr<const ByteBuffer> held;
+        std::span<const uint8_t> data;
+        for (size_t i = chunk.first_block; i <= chunk.last_block; ++i) {
+          auto decoded = cache.get(i, [&] { return decode(i); });
+          uint64_t from = std::max(chunk.begin, block_begin[i]);
+          uint64_t to = std::min(chunk.end, block_begin[i + 1]);
+          auto piece = decoded->span().subspan(
+              static_cast<size_t>(from - block_begin[i]),
+              static_cast<size_t>(to - from));
+          if (chunk.first_block == chunk.last_block) {
+            held = std::move(decoded);
+            data = piece;
+          } else {
+            if (chunk_buf.size() < chunk_size)
+              chunk_buf = ByteBuffer(max_chunk);
+            std::copy(piece.begin(), piece.end(),
+                      chunk_buf.begin() + (from - chunk.begin));
+            data = chunk_buf.span().first(chunk_size);
+          }
+        }
+
+        // Stored chunks are written straight from the decoded blocks.
+        ByteBuffer packed;
+        std::span<const uint8_t> out = data;
+        if (options.output_codec != CompressionType::None) {
+          PhaseTimer timer(options, Phase::Encode, data.size());
+          packed = compress_block(options.output_codec, data,
+                                  options.output_mode, options.level);
+          out = packed;
+        }
+
+        // Chunks are handed out in order, so the ones ahead of this one
+        // are all held by running workers and the wait is bounded.
+        std::unique_lock lock(write_mutex);
+        write_turn.wait(lock, [&] { return next_write == c || failed; });
+        if (failed)
+          return;
+        timed_write(output, out_cursor, out, options);
+        new_blocks[c] = {static_cast<uint32_t>(chunk_size),
+                         static_cast<uint32_t>(out.size()), block_flags};
+        out_cursor += out.size();
+        ++next_write;
+        lock.unlock();
+        write_turn.notify_all();
+
+        held.reset();
+        for (size_t i = chunk.first_block; i <= chunk.last_block; ++i)
+          cache.release(i);
+      }
+    } catch (...) {
+      {
+        std::lock_guard lock(write_mutex);
+        failed = true;
+      }
+      write_turn.notify_all();
+      throw;
+    }
+  });
+
+  uint64_t data_size = out_cursor - data_offset;
+  timed_write(output, 0, make_prefix(data_size), options);
+  PhaseTimer timer(options, Phase::Write);
+  output.resize(out_cursor);
+  output.close();
+}
+
+// Rewrites the LZ4AK blocks of an Arknights bundle as standard LZ4 without
+// decoding them. Every block keeps its compressed size, so the output has
+// the same layout as the input behind a rebuilt prefix, and blocks are
+// patched in parallel straight into place.
+void process_file_transcode(const fs::path &input_path,
+                            const fs::path &output_path,
+                            const ProcessOptions &options,
+                            FileProgress &progress) {
+  if (options.game_mode != GameMode::Arknights)
+    throw std::runtime_error("--transcode lz4 needs --game arknights");
+
+  InputFile input(input_path);
+  BundleSource source = read_bundle_source(input, options);
+  const BundleHeader &header = source.header;
+  const auto &blocks = source.dir.blocks;
+  const auto &nodes = source.dir.nodes;
+
+  std::vector<ArchiveBlockInfo> new_blocks = blocks;
+  auto make_prefix = [&] {
+    PhaseTimer timer(options, Phase::Rebuild);
+    uint64_t data_size = 0;
+    for (const auto &b : new_blocks)
+      data_size += b.compressed_size;
+    auto block_info = build_block_info(new_blocks, nodes);
+    auto prefix = build_header(header.version, header.unity_ver,
+                               header.unity_rev, FLAG_BLOCKS_AND_DIR_COMBINED,
+                               block_info.size(), data_size);
+    prefix.insert(prefix.end(), block_info.begin(), block_info.end());
+    return prefix;
+  };
+  size_t data_offset = make_prefix().size();
+  uint64_t data_start = blocks.empty() ? 0 : source.src_offsets[0];
+
+  size_t max_compressed = 0;
+  for (const auto &b : blocks)
+    max_compressed = std::max<size_t>(max_compressed, b.compressed_size);
+  size_t workers = resolve_thread_count(options.threads);
+  if (options.max_memory != 0)
+    workers = static_cast<size_t>(std::clamp<uint64_t>(
+        options.max_memory / std::max<size_t>(max_compressed, 1), 1,
+        workers));
+
+  OutputFile output(output_path);
+  std::atomic<size_t> next_block{0};
+  std::atomic<bool> failed{false};
+
+  parallel_for(workers, workers, [&](size_t) {
+    ByteBuffer buf(max_compressed);
+    try {
+      for (size_t i; !failed && (i = next_block++) < blocks.size();) {
+        auto block = buf.span().first(blocks[i].compressed_size);
+        timed_read(input, source.src_offsets[i], block, options);
+
+        size_t decoded = blocks[i].uncompressed_size;
+        if (blocks[i].get_compression() == CompressionType::Lzham) {
+          int res = timed(options, Phase::Encode,
+                          [&] { return lz4_from_lz4ak(block); });
+          if (res < 0)
+            throw std::runtime_error(
+                std::format("Block {} is not valid LZ4AK", i));
+          decoded = static_cast<size_t>(res);
+          if (decoded > blocks[i].uncompressed_size)
+            throw std::runtime_error(std::format(
+                "Block {} decodes to {} bytes, more than the {} declared", i,
+                decoded, blocks[i].uncompressed_size));
+          new_blocks[i].uncompressed_size = static_cast<uint32_t>(decoded);
+          new_blocks[i].flags = static_cast<uint16_t>(
+              (blocks[i].flags & ~FLAG_COMPRESSION_MASK) |
+              static_cast<uint16_t>(CompressionType::Lz4));
+        }
+        timed_write(output, data_offset + (source.src_offsets[i] - data_start),
+                    block, options);
+        progress.block_done(blocks[i].compressed_size);
+      }
+    } catch (...) {
+      failed = true;
+      throw;
+    }
+  });
+
+  auto prefix = make_prefix();
+  timed_write(output, 0, prefix, options);
+  PhaseTimer timer(options, Phase::Write);
+  output.close();
+}
+
+// Writes just the bytes of one node. The node's range is mapped onto the
+// cumulative decoded block ranges, and only the blocks it overlaps are
+// read and decoded, the last of them only up to where the node ends.
+void process_file_extract(const fs::path &input_path,
+                          const fs::path &output_path,
+                          const ProcessOptions &options,
+                          FileProgress &progress) {
+  InputFile input(input_path);
+  BundleSource source = read_bundle_source(input, options);
+  const auto &blocks = source.dir.blocks;
+  const auto &nodes = source.dir.nodes;
+
+  auto node = std::ranges::find(nodes, options.extract_node,
+                                &ArchiveNode::path);
+  if (node == nodes.end())
+    throw std::runtime_error(
+        std::format("No node named {} in the bundle", options.extract_node));
+  const uint64_t node_begin = node->offset;
+  const uint64_t node_end = node->offset + node->size;
+
+  struct Piece {
+    size_t block;
+    // Range of the block's decoded bytes that belongs to the node.
+    size_t from;
+    size_t to;
+    uint64_t out_offset;
+  };
+  std::vector<Piece> pieces;
+  size_t max_compressed = 0;
+  size_t max_prefix = 0;
+  uint64_t block_begin = 0;
+  for (size_t i = 0; i < blocks.size() && block_begin < node_end; ++i) {
+    uint64_t block_size = blocks[i].get_compression() == CompressionType::None
+                              ? blocks[i].compressed_size
+                              : blocks[i].uncompressed_size;
+    uint64_t block_end = block_begin + block_size;
+    if (block_end > node_begin && block_size != 0) {
+      Piece piece{i,
+                  static_cast<size_t>(std::max(node_begin, block_begin) -
+                                      block_begin),
+                  static_cast<size_t>(std::min(node_end, block_end) -
+                                      block_begin),
+                  std::max(node_begin, block_begin) - node_begin};
+      pieces.push_back(piece);
+      max_compressed =
+          std::max<size_t>(max_compressed, blocks[i].compressed_size);
+      max_prefix = std::max(max_prefix, piece.to);
+    }
+    block_begin = block_end;
+  }
+  if (block_begin < node_end)
+    throw std::out_of_range(std::format(
+        "node {} ends at {} but the blocks only hold {} bytes", node->path,
+        node_end, block_begin));
+
+  uint64_t per_worker = std::max<uint64_t>(max_compressed + max_prefix, 1);
+  size_t workers = resolve_thread_count(options.threads);
+  if (options.max_memory != 0)
+    workers = static_cast<size_t>(
+        std::clamp<uint64_t>(options.max_memory / per_worker, 1, workers));
+
+  OutputFile output(output_path);
+  std::atomic<size_t> next_piece{0};
+  std::atomic<bool> failed{false};
+
+  parallel_for(workers, workers, [&](size_t) {
+    ByteBuffer src_buf(max_compressed);
+    ByteBuffer dst_buf(max_prefix);
+    try {
+      for (size_t p; !failed && (p = next_piece++) < pieces.size();) {
+        const Piece &piece = pieces[p];
+        const auto &blk = blocks[piece.block];
+        auto src = src_buf.span().first(blk.compressed_size);
+        timed_read(input, source.src_offsets[piece.block], src, options);
+
+        auto prefix = dst_buf.span().first(piece.to);
+        timed_decode(options, blk.get_compression(), options.game_mode,
+                     blk.compressed_size, [&] {
+                       decompress_block_prefix(blk.get_compression(), src,
+                                               prefix, blk.uncompressed_size,
+                                               options.game_mode);
+                       return prefix.size();
+                     });
+        timed_write(output, piece.out_offset, prefix.subspan(piece.from),
+                    options);
+        progress.block_done(blk.compressed_size);
+      }
+    } catch (...) {
+      failed = true;
+      throw;
+    }
+  });
+
+  PhaseTimer timer(options, Phase::Write);
+  output.resize(node->size);
+  output.close();
+}
+
+} // namespace
+
+void process_file(const fs::path &input_path, const fs::path &output_path,
+                  const ProcessOptions &options) {
+  if (!fs::exists(input_path)) {
+    throw std::runtime_error("Input file not found");
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  uint64_t input_size = fs::file_size(input_path);
+  {
+    FileProgress progress(options.progress, input_size);
+    if (!options.extract_node.empty())
+      process_file_extract(input_path, output_path, options, progress);
+    else if (options.transcode_lz4)
+      process_file_transcode(input_path, output_path, options, progress);
+    else if (options.output_codec != CompressionType::None ||
+             options.chunk_size != 0)
+      process_file_recompress(input_path, output_path, options, progress);
+    else if (options.max_memory != 0)
+      process_file_streaming(input_path, output_path, options, progress);
+    else
+      process_file_mapped(input_path, output_path, options, progress);
+  }
+
+  if (options.stats)
+    options.stats->add_file(input_size, fs::file_size(output_path));
+  if (options.trace)
+    options.trace->file(input_path.string(), start,
+                        std::chrono::steady_clock::now());
+}
+
+void convert_file(const fs::path &input_path, const fs::path &output_path,
+                  const ProcessOptions &options) {
+  fs::path temp = output_path;
+  temp += ".tmp";
+
+  // Hashed up front: the input may be the output this run replaces.
+  std::string cache_key;
+  if (options.cache) {
+    cache_key = options.cache->key(input_path, options);
+    std::error_code ec;
+    fs::remove(temp, ec);
+    if (options.cache->fetch(cache_key, temp)) {
+      FileProgress{options.progress, fs::file_size(input_path)};
+      // An output from an earlier run may be a hard link to the same
+      // entry, and renaming between two links to one file is a no-op
+      // that would leave the temporary behind.
+      if (fs::exists(output_path, ec) && fs::equivalent(temp, output_path))
+        fs::remove(temp);
+      else
+        fs::rename(temp, output_path);
+      print_status(options, std::format("Cached. Output written to {}",
+                                        output_path.string()));
+      return;
+    }
+  }
+
+  try {
+    process_file(input_path, temp, options);
+  } catch (...) {
+    std::error_code ec;
+    fs::remove(temp, ec);
+    throw;
+  }
+
+  if (options.cache)
+    options.cache->store(cache_key, temp);
+  fs::rename(temp, output_path);
+
+  print_status(options, std::format("Success. Output written to {}",
+                                    output_path.string()));
+}
+
+namespace {
+
+struct BatchItem {
+  fs::path input;
+  fs::path output;
+  uintmax_t size = 0;
+};
+
+// Expands files and directory trees into (input, output) pairs. A tree is
+// mirrored under `output_root` relative to the directory that was named;
+// a plain file lands directly in `output_root`.
+std::vector<BatchItem> collect_batch(const std::vector<fs::path> &inputs,
+                                     const fs::path &output_root) {
+  std::vector<BatchItem> items;
+  for (const auto &input : inputs) {
+    if (fs::is_directory(input)) {
+      for (const auto &entry : fs::recursive_directory_iterator(input)) {
+        if (!entry.is_regular_file())
+          continue;
+        items.push_back({entry.path(),
+                         output_root / fs::relative(entry.path(), input),
+                         entry.file_size()});
+      }
+    } else if (fs::is_regular_file(input)) {
+      items.push_back(
+          {input, output_root / input.filename(), fs::file_size(input)});
+    } else {
+      throw std::runtime_error(
+          std::format("Input not found: {}", input.string()));
+    }
+  }
+  return items;
+}
+
+bool is_unityfs(const fs::path &path) {
+  constexpr std::string_view signature{"UnityFS\0", 8};
+  char buf[8] = {};
+  std::ifstream ifs(path, std::ios::binary);
+  ifs.read(buf, sizeof(buf));
+  return ifs.gcount() == sizeof(buf) &&
+         std::string_view(buf, sizeof(buf)) == signature;
+}
+
+} // namespace
+
+size_t run_batch(const std::vector<fs::path> &inputs,
+                 const fs::path &output_root, ProcessOptions options) {
+  auto items = collect_batch(inputs, output_root);
+  // Largest first, so one big bundle does not end up last on one worker.
+  std::stable_sort(items.begin(), items.end(),
+                   [](const BatchItem &a, const BatchItem &b) {
+                     return a.size > b.size;
+                   });
+
+  unsigned workers = resolve_thread_count(options.threads);
+  ProgressReporter progress(options.quiet);
+  uint64_t total_size = 0;
+  for (const auto &item : items)
+    total_size += item.size;
+  progress.add_work(items.size(), total_size);
+  options.threads = 1;
+  options.quiet = true;
+  options.progress = &progress;
+
+  std::atomic<size_t> skipped{0};
+  std::atomic<size_t> failed{0};
+
+  std::cout << std::format("Processing {} files on {} threads...\n",
+                           items.size(), workers);
+
+  // Only files that need attention get a line of their own; the rest show
+  // up in the status line.
+  parallel_for(items.size(), workers, [&](size_t i) {
+    const auto &item = items[i];
+    try {
+      if (!is_unityfs(item.input)) {
+        ++skipped;
+        FileProgress{&progress, item.size};
+        progress.message(std::format("{}: skipped (not UnityFS)",
+                                     item.input.string()));
+      } else {
+        std::error_code ec;
+        fs::create_directories(item.output.parent_path(), ec);
+        if (ec && !fs::is_directory(item.output.parent_path()))
+          throw fs::filesystem_error("Cannot create directory",
+                                     item.output.parent_path(), ec);
+        convert_file(item.input, item.output, options);
+      }
+    } catch (const std::exception &e) {
+      ++failed;
+      progress.message(
+          std::format("{}: error: {}", item.input.string(), e.what()));
+    }
+  });
+  progress.finish();
+
+  std::cout << std::format("Done: {} converted, {} skipped, {} failed\n",
+                           items.size() - skipped - failed, skipped.load(),
+                           failed.load());
+  return failed;
+}
+
+std::string list_bundle_json(const fs::path &input_path, GameMode mode) {
+  InputFile input(input_path);
+  BundleSource source = read_bundle_source(input, ProcessOptions{});
+  const BundleHeader &h = source.header;
+
+  std::string json = std::format(
+      "{{\"path\":{},\"version\":{},\"unity_version\":{},"
+      "\"unity_revision\":{},\"size\":{},\"flags\":{},"
+      "\"block_info_compression\":\"{}\","
+      "\"compressed_block_info_size\":{},"
+      "\"uncompressed_block_info_size\":{},\"blocks\":[",
+      json_quote(input_path.string()), h.version, json_quote(h.unity_ver),
+      json_quote(h.unity_rev), h.bundle_size, h.flags,
+      compression_name(
+          static_cast<CompressionType>(h.flags & FLAG_COMPRESSION_MASK),
+          GameMode::Standard),
+      h.compressed_blocks_info_size, h.uncompressed_blocks_info_size);
+  for (size_t b = 0; b < source.dir.blocks.size(); ++b) {
+    const auto &blk = source.dir.blocks[b];
+    json += std::format(
+        "{}{{\"uncompressed_size\":{},\"compressed_size\":{},"
+        "\"flags\":{},\"compression\":\"{}\"}}",
+        b == 0 ? "" : ",", blk.uncompressed_size, blk.compressed_size,
+        blk.flags, compression_name(blk.get_compression(), mode));
+  }
+  json += "],\"nodes\":[";
+  for (size_t n = 0; n < source.dir.nodes.size(); ++n) {
+    const auto &node = source.dir.nodes[n];
+    json += std::format(
+        "{}{{\"offset\":{},\"size\":{},\"status\":{},\"path\":{}}}",
+        n == 0 ? "" : ",", node.offset, node.size, node.status,
+        json_quote(node.path));
+  }
+  json += "]}";
+  return json;
+}
+
+size_t list_files(const std::vector<fs::path> &inputs,
+                  const ProcessOptions &options) {
+  auto items = collect_batch(inputs, {});
+  std::vector<std::string> lines(items.size());
+  std::atomic<size_t> failed{0};
+
+  parallel_for(items.size(), options.threads, [&](size_t i) {
+    const fs::path &path = items[i].input;
+    if (!is_unityfs(path))
+      return;
+    try {
+      lines[i] = list_bundle_json(path, options.game_mode);
+    } catch (const std::exception &e) {
+      ++failed;
+      lines[i] = std::format("{{\"path\":{},\"error\":{}}}",
+                             json_quote(path.string()), json_quote(e.what()));
+    }
+  });
+
+  for (const auto &line : lines)
+    if (!line.empty())
+      std::cout << line << '\n';
+  std::cout << std::flush;
+  return failed;
+}
+
+uint64_t parse_byte_size(const std::string &text) {
+  size_t used = 0;
+  uint64_t value = std::stoull(text, &used);
+  std::string suffix = text.substr(used);
+  if (suffix.empty() || suffix == "B")
+    return value;
+  if (suffix == "K" || suffix == "KB" || suffix == "KiB")
+    return value << 10;
+  if (suffix == "M" || suffix == "MB" || suffix == "MiB")
+    return value << 20;
+  if (suffix == "G" || suffix == "GB" || suffix == "GiB")
+    return value << 30;
+  throw std::runtime_error(std::format("Invalid size: {}", text));
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "codec.h"
+
+class PerfCounters;
+class ProgressReporter;
+class ResultCache;
+class RunStats;
+class TraceRecorder;
+
+struct ProcessOptions {
+  GameMode game_mode = GameMode::Standard;
+  // Worker threads used to decode blocks; 0 picks the hardware concurrency.
+  unsigned threads = 1;
+  // When non-zero, stream the bundle through buffers bounded by this many
+  // bytes instead of mapping the input and output files.
+  uint64_t max_memory = 0;
+  // Suppresses the status lines, for batch runs where several files are
+  // in flight at once.
+  bool quiet = false;
+  // Codec the output blocks are re-encoded with; None (the default) writes
+  // stored blocks. With an Arknights output mode, Lzham means LZ4AK.
+  CompressionType output_codec = CompressionType::None;
+  GameMode output_mode = GameMode::Standard;
+  // Codec-specific compression level; negative picks the codec's default.
+  int level = -1;
+  // Size of the blocks the output is cut into, stored or re-encoded; 0
+  // keeps the input's block boundaries.
+  uint64_t chunk_size = 0;
+  // Rewrites LZ4AK blocks as standard LZ4 in place of decoding them; the
+  // output keeps the input's compressed size.
+  bool transcode_lz4 = false;
+  // When set, writes only the bytes of the node with this path, decoding
+  // just the blocks it overlaps.
+  std::string extract_node;
+  // When set, convert_file serves conversions it has seen before from this
+  // cache and adds new ones to it. Not owned.
+  ResultCache *cache = nullptr;
+  // When set, every phase of the conversion is timed into it. Not owned.
+  RunStats *stats = nullptr;
+  // When set, phase, block and file spans are recorded into it. Not owned.
+  TraceRecorder *trace = nullptr;
+  // When set, hardware counters are read around every phase and decoded
+  // block on the thread doing it. Not owned.
+  PerfCounters *perf = nullptr;
+  // When set, blocks report the input bytes they consumed to it, and
+  // status lines go through it. Not owned.
+  ProgressReporter *progress = nullptr;
+};
+
+void process_file(const std::filesystem::path &input_path,
+                  const std::filesystem::path &output_path,
+                  const ProcessOptions &options);
+
+// process_file through a temporary file next to the output, renamed into
+// place on success. The input may be the output itself, and a failed run
+// never leaves a partial bundle (or clobbers an existing one). With
+// options.cache, a repeated conversion links the cached result instead.
+void convert_file(const std::filesystem::path &input_path,
+                  const std::filesystem::path &output_path,
+                  const ProcessOptions &options);
+
+// Converts every bundle under `inputs` into `output_root`, one file per
+// worker at a time, with one progress line for the whole batch. Workers
+// live for the whole run, so their per-thread LZMA/LZHAM decoders and
+// buffers are set up once rather than per file.
+// Files that are not UnityFS bundles are skipped; a failing file is
+// reported and does not stop the rest. Returns the number of failures.
+size_t run_batch(const std::vector<std::filesystem::path> &inputs,
+                 const std::filesystem::path &output_root,
+                 ProcessOptions options);
+
+// The header, block table and node list of one bundle as a single-line
+// JSON object, read from the header and block info only.
+std::string list_bundle_json(const std::filesystem::path &input_path,
+                             GameMode mode);
+
+// Prints the header, block table and node list of every bundle under
+// `inputs` (files or directory trees) as one JSON object per line, in
+// input order. Only the header and block info are read, never the data
+// section. Files that are not UnityFS bundles are skipped; a bundle that
+// cannot be parsed is printed as {"path": ..., "error": ...}. Returns the
+// number of such failures.
+size_t list_files(const std::vector<std::filesystem::path> &inputs,
+                  const ProcessOptions &options);
+
+// Parses sizes such as "4096", "512K", "256M" or "2G" (binary units).
+uint64_t parse_byte_size(const std::string &text);
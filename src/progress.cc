@@ -0,0 +1,111 @@
+#include "progress.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <format>
+#include <iostream>
+#include <string>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+bool stdout_is_terminal() {
+#ifdef _WIN32
+  return _isatty(_fileno(stdout)) != 0;
+#else
+  return isatty(fileno(stdout)) != 0;
+#endif
+}
+
+std::string format_duration(double seconds) {
+  auto s = static_cast<uint64_t>(seconds + 0.5);
+  if (s >= 3600)
+    return std::format("{}:{:02}:{:02}", s / 3600, s / 60 % 60, s % 60);
+  return std::format("{}:{:02}", s / 60, s % 60);
+}
+
+constexpr double MIB = 1024.0 * 1024.0;
+
+} // namespace
+
+ProgressReporter::ProgressReporter(bool quiet,
+                                   std::chrono::milliseconds interval)
+    : enabled_(!quiet && stdout_is_terminal()), interval_(interval),
+      start_(std::chrono::steady_clock::now()) {
+  if (enabled_)
+    thread_ = std::thread([this] { run(); });
+}
+
+ProgressReporter::~ProgressReporter() { finish(); }
+
+void ProgressReporter::run() {
+  std::unique_lock lock(mutex_);
+  while (!wake_.wait_for(lock, interval_, [&] { return stopping_; }))
+    draw_locked();
+}
+
+void ProgressReporter::draw_locked() {
+  uint64_t total_files = total_files_.load(std::memory_order_relaxed);
+  uint64_t total = total_bytes_.load(std::memory_order_relaxed);
+  uint64_t done = std::min(done_bytes_.load(std::memory_order_relaxed), total);
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start_)
+                       .count();
+  double rate = elapsed > 0 ? done / elapsed : 0;
+
+  std::string line;
+  if (total_files > 1)
+    line += std::format("[{}/{} files] ",
+                        done_files_.load(std::memory_order_relaxed),
+                        total_files);
+  line += std::format("{:.1f}/{:.1f} MiB", done / MIB, total / MIB);
+  if (total != 0)
+    line += std::format(" ({:.0f}%)", 100.0 * done / total);
+  line += std::format("  {:.1f} MiB/s", rate / MIB);
+  if (rate > 0 && done < total)
+    line += std::format("  ETA {}", format_duration((total - done) / rate));
+  else
+    line += std::format("  {}", format_duration(elapsed));
+
+  size_t width = line.size();
+  if (width < width_)
+    line.append(width_ - width, ' ');
+  width_ = width;
+  std::cout << '\r' << line << std::flush;
+}
+
+void ProgressReporter::message(std::string_view line) {
+  std::lock_guard lock(mutex_);
+  if (enabled_ && width_ != 0) {
+    std::string text(line);
+    if (text.size() < width_)
+      text.append(width_ - text.size(), ' ');
+    std::cout << '\r' << text << '\n';
+    width_ = 0;
+    draw_locked();
+  } else {
+    std::cout << line << '\n' << std::flush;
+  }
+}
+
+void ProgressReporter::finish() {
+  {
+    std::lock_guard lock(mutex_);
+    if (stopping_)
+      return;
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  if (thread_.joinable())
+    thread_.join();
+  if (enabled_) {
+    std::lock_guard lock(mutex_);
+    draw_locked();
+    std::cout << '\n' << std::flush;
+  }
+}
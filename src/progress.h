@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <thread>
+
+// Progress of a whole run, in input bytes and files. Workers only bump
+// relaxed atomic counters; a background thread redraws a single status
+// line with throughput and ETA at a fixed rate. Nothing is drawn when
+// quiet or when stdout is not a terminal, so logs get no carriage-return
+// noise.
+class ProgressReporter {
+public:
+  explicit ProgressReporter(
+      bool quiet,
+      std::chrono::milliseconds interval = std::chrono::milliseconds(200));
+  ~ProgressReporter();
+
+  ProgressReporter(const ProgressReporter &) = delete;
+  ProgressReporter &operator=(const ProgressReporter &) = delete;
+
+  // Adds work still to be done, for the percentage and ETA.
+  void add_work(uint64_t files, uint64_t bytes) {
+    total_files_.fetch_add(files, std::memory_order_relaxed);
+    total_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+  }
+  void advance(uint64_t bytes) {
+    done_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+  }
+  void file_done() { done_files_.fetch_add(1, std::memory_order_relaxed); }
+
+  // Prints `line` to stdout above the status line.
+  void message(std::string_view line);
+
+  // Draws the final state and ends the status line. Called by the
+  // destructor if not before.
+  void finish();
+
+private:
+  void run();
+  void draw_locked();
+
+  const bool enabled_;
+  const std::chrono::milliseconds interval_;
+  const std::chrono::steady_clock::time_point start_;
+
+  std::atomic<uint64_t> total_files_{0};
+  std::atomic<uint64_t> total_bytes_{0};
+  std::atomic<uint64_t> done_files_{0};
+  std::atomic<uint64_t> done_bytes_{0};
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stopping_ = false;
+  // Length of the status line on screen, so a shorter one can blank it.
+  size_t width_ = 0;
+  std::thread thread_;
+};
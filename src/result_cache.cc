@@ -0,0 +1,304 @@
+#include "result_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <random>
+#include <span>
+#include <vector>
+
+#include "file_io.h"
+#include "process.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Bump when a change to the converter alters its output, so entries made
+// by older builds stop matching.
+constexpr unsigned CACHE_FORMAT = 1;
+
+constexpr size_t HASH_CHUNK_SIZE = 1 << 20;
+
+constexpr uint64_t P1 = 0x9E3779B185EBCA87;
+constexpr uint64_t P2 = 0xC2B2AE3D27D4EB4F;
+constexpr uint64_t P3 = 0x165667B19E3779F9;
+constexpr uint64_t P4 = 0x85EBCA77C2B2AE63;
+constexpr uint64_t P5 = 0x27D4EB2F165667C5;
+
+uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+uint64_t read64(const uint8_t *p) {
+  uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+uint32_t read32(const uint8_t *p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+uint64_t xxh_round(uint64_t acc, uint64_t input) {
+  return rotl(acc + input * P2, 31) * P1;
+}
+
+uint64_t xxh_merge(uint64_t acc, uint64_t v) {
+  return (acc ^ xxh_round(0, v)) * P1 + P4;
+}
+
+// XXH64 (little-endian hosts). Several GB/s per core, so hashing an input
+// costs about as much as reading it.
+uint64_t xxh64(std::span<const uint8_t> data, uint64_t seed) {
+  const uint8_t *p = data.data();
+  const uint8_t *const end = p + data.size();
+  uint64_t h;
+
+  if (data.size() >= 32) {
+    uint64_t v1 = seed + P1 + P2;
+    uint64_t v2 = seed + P2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - P1;
+    do {
+      v1 = xxh_round(v1, read64(p));
+      v2 = xxh_round(v2, read64(p + 8));
+      v3 = xxh_round(v3, read64(p + 16));
+      v4 = xxh_round(v4, read64(p + 24));
+      p += 32;
+    } while (end - p >= 32);
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = xxh_merge(h, v1);
+    h = xxh_merge(h, v2);
+    h = xxh_merge(h, v3);
+    h = xxh_merge(h, v4);
+  } else {
+    h = seed + P5;
+  }
+
+  h += data.size();
+  for (; end - p >= 8; p += 8)
+    h = rotl(h ^ xxh_round(0, read64(p)), 27) * P1 + P4;
+  if (end - p >= 4) {
+    h = rotl(h ^ (read32(p) * P1), 23) * P2 + P3;
+    p += 4;
+  }
+  for (; p < end; ++p)
+    h = rotl(h ^ (*p * P5), 11) * P1;
+
+  h ^= h >> 33;
+  h *= P2;
+  h ^= h >> 29;
+  h *= P3;
+  h ^= h >> 32;
+  return h;
+}
+
+// Hashes the file in fixed chunks and then the list of chunk hashes, so it
+// streams through a bounded buffer however large the input is.
+uint64_t hash_file(const fs::path &path) {
+  InputFile input(path);
+  std::vector<uint8_t> buffer(
+      std::min<uint64_t>(HASH_CHUNK_SIZE, input.size()));
+  std::vector<uint64_t> chunk_hashes;
+  for (uint64_t offset = 0; offset < input.size();) {
+    size_t n = static_cast<size_t>(
+        std::min<uint64_t>(buffer.size(), input.size() - offset));
+    input.read_at(offset, std::span(buffer).first(n));
+    chunk_hashes.push_back(xxh64(std::span(buffer).first(n), 0));
+    offset += n;
+  }
+  return xxh64(std::span(reinterpret_cast<const uint8_t *>(
+                             chunk_hashes.data()),
+                         chunk_hashes.size() * sizeof(uint64_t)),
+               input.size());
+}
+
+// Marker whose modification time records when an entry was last served.
+// The entry's own times are left alone: a hit may hard-link it to an
+// output, and touching the shared inode would change that file too.
+fs::path used_marker(const fs::path &entry) {
+  fs::path marker = entry;
+  marker += ".used";
+  return marker;
+}
+
+bool is_entry_name(const std::string &name) {
+  return name.size() == 32 &&
+         std::ranges::all_of(name, [](char c) {
+           return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+         });
+}
+
+} // namespace
+
+ResultCache::ResultCache(const fs::path &dir, uint64_t max_bytes)
+    : dir_(dir), max_bytes_(max_bytes) {
+  fs::create_directories(dir_);
+
+  struct Found {
+    fs::file_time_type mtime;
+    std::string key;
+    uint64_t size;
+  };
+  std::vector<Found> found;
+  for (const auto &entry : fs::recursive_directory_iterator(dir_)) {
+    if (!entry.is_regular_file())
+      continue;
+    std::error_code ec;
+    if (entry.path().extension() == ".tmp") {
+      // Left behind by a run that died while storing.
+      fs::remove(entry.path(), ec);
+      continue;
+    }
+    if (entry.path().extension() == ".used") {
+      fs::path stem = entry.path();
+      stem.replace_extension();
+      if (!fs::exists(stem, ec))
+        fs::remove(entry.path(), ec);
+      continue;
+    }
+    std::string name = entry.path().filename().string();
+    if (!is_entry_name(name) || entry.path() != entry_path(name))
+      continue;
+    auto mtime = entry.last_write_time();
+    auto used = fs::last_write_time(used_marker(entry.path()), ec);
+    if (!ec)
+      mtime = std::max(mtime, used);
+    found.push_back({mtime, name, entry.file_size()});
+  }
+
+  // Most recently used first, matching lru_.
+  std::ranges::sort(found, [](const Found &a, const Found &b) {
+    return a.mtime > b.mtime;
+  });
+  for (auto &f : found) {
+    lru_.push_back(f.key);
+    entries_[f.key] = {f.size, std::prev(lru_.end())};
+    total_bytes_ += f.size;
+  }
+
+  std::lock_guard lock(mutex_);
+  evict_locked();
+}
+
+std::string ResultCache::key(const fs::path &input,
+                             const ProcessOptions &options) const {
+  uint64_t content = hash_file(input);
+  std::string settings = std::format(
+      "{}|{}|{}|{}|{}|{}|{}|{}", CACHE_FORMAT,
+      static_cast<int>(options.game_mode),
+      static_cast<int>(options.output_codec),
+      static_cast<int>(options.output_mode), options.level,
+      options.chunk_size, options.transcode_lz4, options.extract_node);
+  uint64_t salt = xxh64(
+      std::span(reinterpret_cast<const uint8_t *>(settings.data()),
+                settings.size()),
+      content);
+  return std::format("{:016x}{:016x}", content, salt);
+}
+
+fs::path ResultCache::entry_path(const std::string &key) const {
+  return dir_ / key.substr(0, 2) / key;
+}
+
+bool ResultCache::fetch(const std::string &key, const fs::path &output) {
+  fs::path path = entry_path(key);
+  uint64_t size;
+  {
+    std::lock_guard lock(mutex_);
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+      ++stats_.misses;
+      return false;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+    size = it->second.size;
+  }
+
+  // Linked outside the lock; if an eviction wins the race the link fails
+  // and this is a miss like any other.
+  try {
+    link_file(path, output);
+  } catch (const std::exception &) {
+    std::error_code ec;
+    fs::remove(output, ec);
+    std::lock_guard lock(mutex_);
+    auto it = entries_.find(key);
+    if (it != entries_.end() && !fs::exists(path, ec)) {
+      total_bytes_ -= it->second.size;
+      lru_.erase(it->second.lru);
+      entries_.erase(it);
+    }
+    ++stats_.misses;
+    return false;
+  }
+
+  // Recency for the next run's index.
+  fs::path marker = used_marker(path);
+  std::ofstream(marker, std::ios::app);
+  std::error_code ec;
+  fs::last_write_time(marker, fs::file_time_type::clock::now(), ec);
+
+  std::lock_guard lock(mutex_);
+  ++stats_.hits;
+  stats_.hit_bytes += size;
+  return true;
+}
+
+void ResultCache::store(const std::string &key, const fs::path &file) {
+  fs::path path = entry_path(key);
+  fs::path temp = path;
+  temp += std::format(".{:08x}.tmp", std::random_device{}());
+  uint64_t size;
+
+  try {
+    fs::create_directories(path.parent_path());
+    link_file(file, temp);
+    fs::rename(temp, path);
+    size = fs::file_size(path);
+  } catch (const std::exception &) {
+    std::error_code ec;
+    fs::remove(temp, ec);
+    std::lock_guard lock(mutex_);
+    ++stats_.store_failures;
+    return;
+  }
+
+  std::lock_guard lock(mutex_);
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    // Another worker converted the same input at the same time.
+    total_bytes_ -= it->second.size;
+    lru_.erase(it->second.lru);
+    entries_.erase(it);
+  }
+  lru_.push_front(key);
+  entries_[key] = {size, lru_.begin()};
+  total_bytes_ += size;
+  ++stats_.stored;
+  evict_locked();
+}
+
+void ResultCache::evict_locked() {
+  while (total_bytes_ > max_bytes_ && !lru_.empty()) {
+    const std::string &key = lru_.back();
+    std::error_code ec;
+    fs::remove(entry_path(key), ec);
+    fs::remove(used_marker(entry_path(key)), ec);
+    total_bytes_ -= entries_[key].size;
+    entries_.erase(key);
+    lru_.pop_back();
+    ++stats_.evicted;
+  }
+}
+
+ResultCache::Stats ResultCache::stats() const {
+  std::lock_guard lock(mutex_);
+  Stats s = stats_;
+  s.entries = entries_.size();
+  s.bytes = total_bytes_;
+  return s;
+}
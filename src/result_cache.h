@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+struct ProcessOptions;
+
+// On-disk cache of converted bundles, keyed by a hash of the input's
+// contents and of every option that changes the output. Entries are
+// materialized by reflink or hard link where the filesystem allows, so a
+// hit costs one read of the input (to hash it) and no decoding.
+//
+// The cache is bounded by `max_bytes` and evicts least recently used
+// entries; recency survives restarts through a marker file next to each
+// entry, touched on every hit. One instance may be shared by any number
+// of threads.
+class ResultCache {
+public:
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    // Output bytes served from the cache instead of being decoded.
+    uint64_t hit_bytes = 0;
+    uint64_t stored = 0;
+    uint64_t evicted = 0;
+    // Entries that could not be written; the conversion itself succeeded.
+    uint64_t store_failures = 0;
+    uint64_t entries = 0;
+    uint64_t bytes = 0;
+  };
+
+  // Opens (creating if needed) the cache in `dir`, indexes the entries
+  // already there and evicts down to `max_bytes`.
+  ResultCache(const std::filesystem::path &dir, uint64_t max_bytes);
+
+  ResultCache(const ResultCache &) = delete;
+  ResultCache &operator=(const ResultCache &) = delete;
+
+  // The cache key of converting `input` with `options`.
+  std::string key(const std::filesystem::path &input,
+                  const ProcessOptions &options) const;
+
+  // Creates `output` (which must not exist) from the entry for `key`.
+  // Returns false, counting a miss, if there is no usable entry.
+  bool fetch(const std::string &key, const std::filesystem::path &output);
+
+  // Adds `file` as the entry for `key`, evicting older entries to stay
+  // within the size limit. Failures are counted, not thrown: the cache is
+  // only ever an optimization.
+  void store(const std::string &key, const std::filesystem::path &file);
+
+  Stats stats() const;
+
+private:
+  struct Entry {
+    uint64_t size;
+    // Position in lru_, most recently used first.
+    std::list<std::string>::iterator lru;
+  };
+
+  std::filesystem::path entry_path(const std::string &key) const;
+  void evict_locked();
+
+  std::filesystem::path dir_;
+  uint64_t max_bytes_;
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Entry> entries_;
+  std::list<std::string> lru_;
+  uint64_t total_bytes_ = 0;
+  Stats stats_;
+};
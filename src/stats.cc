@@ -0,0 +1,227 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <bit>
+#include <format>
+#include <memory>
+
+namespace {
+
+std::string_view mode_name(GameMode mode) {
+  return mode == GameMode::Arknights ? "arknights" : "std";
+}
+
+std::string size_class_label(unsigned size_class) {
+  if (size_class >= 30)
+    return std::format("{}G", 1u << (size_class - 30));
+  if (size_class >= 20)
+    return std::format("{}M", 1u << (size_class - 20));
+  if (size_class >= 10)
+    return std::format("{}K", 1u << (size_class - 10));
+  return std::format("{}", 1u << size_class);
+}
+
+double seconds(uint64_t nanos) { return static_cast<double>(nanos) / 1e9; }
+
+double mb_per_s(uint64_t bytes, uint64_t nanos) {
+  return nanos == 0 ? 0 : static_cast<double>(bytes) * 1e3 / nanos;
+}
+
+} // namespace
+
+std::string_view phase_name(Phase phase) {
+  switch (phase) {
+  case Phase::Read:
+    return "read";
+  case Phase::Header:
+    return "header";
+  case Phase::BlockInfo:
+    return "block_info";
+  case Phase::Decode:
+    return "decode";
+  case Phase::Encode:
+    return "encode";
+  case Phase::Rebuild:
+    return "rebuild";
+  case Phase::Write:
+    return "write";
+  }
+  return "unknown";
+}
+
+size_t codec_slot(CompressionType type, GameMode mode) {
+  auto index = static_cast<size_t>(type);
+  if (type == CompressionType::Lzham && mode == GameMode::Arknights)
+    return CODEC_SLOTS - 1;
+  return index < CODEC_SLOTS - 1 ? index : CODEC_SLOTS;
+}
+
+std::pair<CompressionType, GameMode> slot_codec(size_t slot) {
+  if (slot == CODEC_SLOTS - 1)
+    return {CompressionType::Lzham, GameMode::Arknights};
+  return {static_cast<CompressionType>(slot), GameMode::Standard};
+}
+
+RunStats::RunStats() : start_(clock::now()) {}
+
+RunStats::~RunStats() {
+  for (auto &h : latency_)
+    delete h.load();
+}
+
+void RunStats::add_phase(Phase phase, clock::duration elapsed,
+                         uint64_t bytes) {
+  auto &p = phases_[static_cast<size_t>(phase)];
+  p.calls.fetch_add(1, std::memory_order_relaxed);
+  p.nanos.fetch_add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+      std::memory_order_relaxed);
+  p.bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void RunStats::add_decode(CompressionType type, GameMode mode,
+                          uint64_t compressed, uint64_t decoded,
+                          clock::duration elapsed) {
+  size_t slot = codec_slot(type, mode);
+  if (slot == CODEC_SLOTS)
+    return;
+  auto &c = codecs_[slot];
+  c.blocks.fetch_add(1, std::memory_order_relaxed);
+  c.nanos.fetch_add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+      std::memory_order_relaxed);
+  c.compressed.fetch_add(compressed, std::memory_order_relaxed);
+  c.decoded.fetch_add(decoded, std::memory_order_relaxed);
+
+  size_t size_class = std::min<size_t>(
+      std::bit_width(decoded == 0 ? 0 : decoded - 1), SIZE_CLASSES - 1);
+  size_t index = (static_cast<size_t>(type) * 2 + static_cast<size_t>(mode)) *
+                     SIZE_CLASSES +
+                 size_class;
+  auto &slot_ptr = latency_[index];
+  LatencyHistogram *h = slot_ptr.load(std::memory_order_acquire);
+  if (!h) {
+    auto fresh = std::make_unique<LatencyHistogram>();
+    if (slot_ptr.compare_exchange_strong(h, fresh.get(),
+                                         std::memory_order_acq_rel))
+      h = fresh.release();
+  }
+  h->record(static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+}
+
+void RunStats::add_file(uint64_t bytes_in, uint64_t bytes_out) {
+  files_.fetch_add(1, std::memory_order_relaxed);
+  bytes_in_.fetch_add(bytes_in, std::memory_order_relaxed);
+  bytes_out_.fetch_add(bytes_out, std::memory_order_relaxed);
+}
+
+std::vector<LatencySummary> RunStats::latency() const {
+  std::vector<LatencySummary> out;
+  for (size_t i = 0; i < HISTOGRAMS; ++i) {
+    const LatencyHistogram *h = latency_[i].load(std::memory_order_acquire);
+    if (!h || h->count() == 0)
+      continue;
+    size_t codec = i / SIZE_CLASSES;
+    out.push_back({static_cast<CompressionType>(codec / 2),
+                   static_cast<GameMode>(codec % 2),
+                   static_cast<unsigned>(i % SIZE_CLASSES), h->count(),
+                   h->min(), h->percentile(0.5), h->percentile(0.9),
+                   h->percentile(0.99), h->percentile(0.999), h->max()});
+  }
+  return out;
+}
+
+std::string RunStats::text() const {
+  double wall = std::chrono::duration<double>(clock::now() - start_).count();
+  std::string out = std::format(
+      "{} files, {} bytes in, {} bytes out, {:.3f} s wall\n", files_.load(),
+      bytes_in_.load(), bytes_out_.load(), wall);
+
+  out += std::format("{:<12}{:>10}{:>12}{:>16}{:>10}\n", "phase", "calls",
+                     "seconds", "bytes", "MB/s");
+  for (size_t i = 0; i < PHASE_COUNT; ++i) {
+    const auto &p = phases_[i];
+    if (p.calls == 0)
+      continue;
+    out += std::format("{:<12}{:>10}{:>12.4f}{:>16}{:>10.1f}\n",
+                       phase_name(static_cast<Phase>(i)), p.calls.load(),
+                       seconds(p.nanos), p.bytes.load(),
+                       mb_per_s(p.bytes, p.nanos));
+  }
+
+  out += std::format("{:<12}{:>10}{:>12}{:>16}{:>16}{:>10}\n", "codec",
+                     "blocks", "seconds", "compressed", "decoded", "MB/s");
+  for (size_t i = 0; i < CODEC_SLOTS; ++i) {
+    const auto &c = codecs_[i];
+    if (c.blocks == 0)
+      continue;
+    auto [type, mode] = slot_codec(i);
+    out += std::format("{:<12}{:>10}{:>12.4f}{:>16}{:>16}{:>10.1f}\n",
+                       compression_name(type, mode), c.blocks.load(),
+                       seconds(c.nanos), c.compressed.load(),
+                       c.decoded.load(), mb_per_s(c.decoded, c.nanos));
+  }
+
+  auto latency_rows = latency();
+  if (!latency_rows.empty()) {
+    out += std::format("{:<12}{:<11}{:>6}{:>10}{:>11}{:>11}{:>11}{:>11}"
+                       "{:>11}\n",
+                       "latency", "mode", "size", "blocks", "p50_us",
+                       "p90_us", "p99_us", "p99.9_us", "max_us");
+    for (const auto &l : latency_rows)
+      out += std::format(
+          "{:<12}{:<11}{:>6}{:>10}{:>11.1f}{:>11.1f}{:>11.1f}{:>11.1f}"
+          "{:>11.1f}\n",
+          compression_name(l.type, l.mode), mode_name(l.mode),
+          "<=" + size_class_label(l.size_class), l.count, l.p50_ns / 1e3,
+          l.p90_ns / 1e3, l.p99_ns / 1e3, l.p999_ns / 1e3, l.max_ns / 1e3);
+  }
+  return out;
+}
+
+std::string RunStats::json() const {
+  double wall = std::chrono::duration<double>(clock::now() - start_).count();
+  std::string out = std::format(
+      "{{\"files\":{},\"bytes_in\":{},\"bytes_out\":{},"
+      "\"wall_seconds\":{:.6f},\"phases\":{{",
+      files_.load(), bytes_in_.load(), bytes_out_.load(), wall);
+  for (size_t i = 0; i < PHASE_COUNT; ++i) {
+    const auto &p = phases_[i];
+    out += std::format("{}\"{}\":{{\"calls\":{},\"seconds\":{:.6f},"
+                       "\"bytes\":{},\"mb_per_s\":{:.3f}}}",
+                       i == 0 ? "" : ",", phase_name(static_cast<Phase>(i)),
+                       p.calls.load(), seconds(p.nanos), p.bytes.load(),
+                       mb_per_s(p.bytes, p.nanos));
+  }
+  out += "},\"codecs\":{";
+  bool first = true;
+  for (size_t i = 0; i < CODEC_SLOTS; ++i) {
+    const auto &c = codecs_[i];
+    if (c.blocks == 0)
+      continue;
+    auto [type, mode] = slot_codec(i);
+    out += std::format("{}\"{}\":{{\"blocks\":{},\"seconds\":{:.6f},"
+                       "\"compressed_bytes\":{},\"decoded_bytes\":{},"
+                       "\"mb_per_s\":{:.3f}}}",
+                       first ? "" : ",", compression_name(type, mode),
+                       c.blocks.load(), seconds(c.nanos),
+                       c.compressed.load(), c.decoded.load(),
+                       mb_per_s(c.decoded, c.nanos));
+    first = false;
+  }
+  out += "},\"latency\":[";
+  first = true;
+  for (const auto &l : latency()) {
+    out += std::format(
+        "{}{{\"codec\":\"{}\",\"mode\":\"{}\",\"max_block_size\":{},"
+        "\"blocks\":{},\"min_ns\":{},\"p50_ns\":{},\"p90_ns\":{},"
+        "\"p99_ns\":{},\"p999_ns\":{},\"max_ns\":{}}}",
+        first ? "" : ",", compression_name(l.type, l.mode),
+        mode_name(l.mode), uint64_t{1} << l.size_class, l.count, l.min_ns,
+        l.p50_ns, l.p90_ns, l.p99_ns, l.p999_ns, l.max_ns);
+    first = false;
+  }
+  out += "]}";
+  return out;
+}
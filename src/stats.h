@@ -0,0 +1,112 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "codec.h"
+#include "histogram.h"
+
+// The steps every conversion goes through. Encode covers re-encoding the
+// output (--compress) and in-place transcoding; Rebuild covers planning
+// the output layout and building its header and block info.
+enum class Phase : uint8_t {
+  Read,
+  Header,
+  BlockInfo,
+  Decode,
+  Encode,
+  Rebuild,
+  Write,
+};
+
+constexpr size_t PHASE_COUNT = 7;
+
+std::string_view phase_name(Phase phase);
+
+// Per-codec counters have one slot per CompressionType, plus LZ4AK in the
+// LZHAM slot's place.
+constexpr size_t CODEC_SLOTS = 6;
+
+// Slot of a codec, or CODEC_SLOTS for an unknown type.
+size_t codec_slot(CompressionType type, GameMode mode);
+std::pair<CompressionType, GameMode> slot_codec(size_t slot);
+
+// Decode latency of one codec, game mode and block size class.
+struct LatencySummary {
+  CompressionType type;
+  GameMode mode;
+  // Blocks of up to 2^size_class decoded bytes (and more than half that).
+  unsigned size_class;
+  uint64_t count;
+  uint64_t min_ns;
+  uint64_t p50_ns;
+  uint64_t p90_ns;
+  uint64_t p99_ns;
+  uint64_t p999_ns;
+  uint64_t max_ns;
+};
+
+// Time and byte counters for a run, shared by every thread and file in it.
+// Phase times are summed across threads, so in a parallel run they can
+// add up to more than the wall time. Decode time is also broken down by
+// codec; reads that the mapped path leaves to page faults show up there
+// rather than under Read. Each decode also lands in a latency histogram
+// for its codec, game mode and power-of-two size class, so slow tails
+// stay visible behind good averages.
+class RunStats {
+public:
+  using clock = std::chrono::steady_clock;
+
+  RunStats();
+  ~RunStats();
+
+  RunStats(const RunStats &) = delete;
+  RunStats &operator=(const RunStats &) = delete;
+
+  void add_phase(Phase phase, clock::duration elapsed, uint64_t bytes);
+  void add_decode(CompressionType type, GameMode mode, uint64_t compressed,
+                  uint64_t decoded, clock::duration elapsed);
+  void add_file(uint64_t bytes_in, uint64_t bytes_out);
+
+  // Every (codec, mode, size class) that saw a block, in that order.
+  std::vector<LatencySummary> latency() const;
+
+  // Multi-line table for people, and one JSON object for dashboards.
+  std::string text() const;
+  std::string json() const;
+
+private:
+  struct PhaseCounter {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> nanos{0};
+    std::atomic<uint64_t> bytes{0};
+  };
+  struct CodecCounter {
+    std::atomic<uint64_t> blocks{0};
+    std::atomic<uint64_t> nanos{0};
+    std::atomic<uint64_t> compressed{0};
+    std::atomic<uint64_t> decoded{0};
+  };
+
+  // Block sizes are 32-bit, so their ceil(log2) is at most 32.
+  static constexpr size_t SIZE_CLASSES = 33;
+  static constexpr size_t TYPE_COUNT = 5;
+  static constexpr size_t HISTOGRAMS = TYPE_COUNT * 2 * SIZE_CLASSES;
+
+  clock::time_point start_;
+  std::atomic<uint64_t> files_{0};
+  std::atomic<uint64_t> bytes_in_{0};
+  std::atomic<uint64_t> bytes_out_{0};
+  std::array<PhaseCounter, PHASE_COUNT> phases_;
+  std::array<CodecCounter, CODEC_SLOTS> codecs_;
+  // Indexed by (type, mode, size class); allocated on first use, since a
+  // run only ever touches a few of them.
+  std::array<std::atomic<LatencyHistogram *>, HISTOGRAMS> latency_{};
+};
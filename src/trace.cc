@@ -0,0 +1,137 @@
+#include "trace.h"
+
+#include <atomic>
+#include <format>
+#include <fstream>
+#include <stdexcept>
+
+#include "json.h"
+
+namespace {
+
+std::atomic<uint64_t> next_recorder_id{1};
+
+constexpr size_t INITIAL_EVENTS = 4096;
+
+int64_t to_ns(std::chrono::steady_clock::duration d) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+} // namespace
+
+TraceRecorder::TraceRecorder(size_t max_events)
+    : id_(next_recorder_id++), origin_(clock::now()),
+      max_events_(max_events) {}
+
+TraceRecorder::ThreadBuffer &TraceRecorder::local() {
+  thread_local uint64_t owner = 0;
+  thread_local ThreadBuffer *buffer = nullptr;
+  if (owner != id_) {
+    std::lock_guard lock(mutex_);
+    auto &added = threads_.emplace_back(std::make_unique<ThreadBuffer>());
+    added->tid = static_cast<uint32_t>(threads_.size());
+    added->events.reserve(INITIAL_EVENTS);
+    buffer = added.get();
+    owner = id_;
+  }
+  return *buffer;
+}
+
+TraceRecorder::Event *TraceRecorder::append(clock::time_point start,
+                                            clock::time_point end) {
+  if (recorded_.fetch_add(1, std::memory_order_relaxed) >= max_events_) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  Event &e = local().events.emplace_back();
+  e.start_ns = to_ns(start - origin_);
+  e.duration_ns = to_ns(end - start);
+  return &e;
+}
+
+void TraceRecorder::phase(Phase phase, clock::time_point start,
+                          clock::time_point end, uint64_t bytes) {
+  Event *e = append(start, end);
+  if (!e)
+    return;
+  e->kind = Kind::Phase;
+  e->detail = static_cast<uint8_t>(phase);
+  e->a = bytes;
+}
+
+void TraceRecorder::block(CompressionType type, GameMode mode,
+                          clock::time_point start, clock::time_point end,
+                          uint64_t compressed, uint64_t decoded) {
+  Event *e = append(start, end);
+  if (!e)
+    return;
+  e->kind = Kind::Block;
+  e->detail = static_cast<uint8_t>(type);
+  e->mode = static_cast<uint8_t>(mode);
+  e->a = compressed;
+  e->b = decoded;
+}
+
+void TraceRecorder::file(const std::string &path, clock::time_point start,
+                         clock::time_point end) {
+  Event *e = append(start, end);
+  if (!e)
+    return;
+  ThreadBuffer &buffer = local();
+  buffer.strings.push_back(path);
+  e->kind = Kind::File;
+  e->a = buffer.strings.size() - 1;
+}
+
+void TraceRecorder::write(const std::filesystem::path &path) const {
+  std::ofstream ofs(path, std::ios::binary);
+  if (!ofs)
+    throw std::runtime_error(std::format("Cannot open {}", path.string()));
+
+  ofs << std::format("{{\"displayTimeUnit\":\"ms\","
+                     "\"otherData\":{{\"dropped_events\":{}}},"
+                     "\"traceEvents\":[\n",
+                     dropped())
+      << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+         "\"args\":{\"name\":\"lzham-ab-decompressor\"}}";
+
+  std::lock_guard lock(mutex_);
+  for (const auto &thread : threads_) {
+    ofs << std::format(",\n{{\"name\":\"thread_name\",\"ph\":\"M\","
+                       "\"pid\":1,\"tid\":{},\"args\":{{\"name\":"
+                       "\"thread {}\"}}}}",
+                       thread->tid, thread->tid);
+    for (const Event &e : thread->events) {
+      std::string head = std::format(
+          ",\n{{\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},"
+          "\"dur\":{:.3f},",
+          thread->tid, e.start_ns / 1e3, e.duration_ns / 1e3);
+      switch (e.kind) {
+      case Kind::Phase:
+        ofs << head
+            << std::format("\"cat\":\"phase\",\"name\":\"{}\","
+                           "\"args\":{{\"bytes\":{}}}}}",
+                           phase_name(static_cast<Phase>(e.detail)), e.a);
+        break;
+      case Kind::Block:
+        ofs << head
+            << std::format(
+                   "\"cat\":\"block\",\"name\":\"decompress_block\","
+                   "\"args\":{{\"codec\":\"{}\",\"compressed_size\":{},"
+                   "\"uncompressed_size\":{}}}}}",
+                   compression_name(static_cast<CompressionType>(e.detail),
+                                    static_cast<GameMode>(e.mode)),
+                   e.a, e.b);
+        break;
+      case Kind::File:
+        ofs << head
+            << std::format("\"cat\":\"file\",\"name\":{}}}",
+                           json_quote(thread->strings[e.a]));
+        break;
+      }
+    }
+  }
+  ofs << "\n]}\n";
+  if (!ofs.flush())
+    throw std::runtime_error(std::format("Failed writing {}", path.string()));
+}
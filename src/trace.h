@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "codec.h"
+#include "stats.h"
+
+// Records phase, block decode and file spans for chrome://tracing and
+// Perfetto. Each thread appends to its own buffer, registered the first
+// time it records, so recording takes no lock and costs an append.
+// Recording stops after `max_events` events, so a long-running daemon
+// cannot grow without bound; later events are only counted.
+class TraceRecorder {
+public:
+  using clock = std::chrono::steady_clock;
+
+  // About 40 MiB of events.
+  static constexpr size_t DEFAULT_MAX_EVENTS = size_t{1} << 20;
+
+  explicit TraceRecorder(size_t max_events = DEFAULT_MAX_EVENTS);
+
+  TraceRecorder(const TraceRecorder &) = delete;
+  TraceRecorder &operator=(const TraceRecorder &) = delete;
+
+  void phase(Phase phase, clock::time_point start, clock::time_point end,
+             uint64_t bytes);
+  void block(CompressionType type, GameMode mode, clock::time_point start,
+             clock::time_point end, uint64_t compressed, uint64_t decoded);
+  void file(const std::string &path, clock::time_point start,
+            clock::time_point end);
+
+  // Writes everything recorded so far as Chrome trace event JSON. No
+  // thread may be recording at the same time.
+  void write(const std::filesystem::path &path) const;
+
+  // Events not recorded because the limit was reached.
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+  enum class Kind : uint8_t { Phase, Block, File };
+
+  struct Event {
+    int64_t start_ns;
+    int64_t duration_ns;
+    // Bytes for phases, compressed/decoded sizes for blocks; for files,
+    // `a` indexes the thread's strings.
+    uint64_t a;
+    uint64_t b;
+    Kind kind;
+    uint8_t detail;
+    uint8_t mode;
+  };
+
+  struct ThreadBuffer {
+    uint32_t tid;
+    std::vector<Event> events;
+    std::vector<std::string> strings;
+  };
+
+  ThreadBuffer &local();
+  // Null once the limit is reached.
+  Event *append(clock::time_point start, clock::time_point end);
+
+  // Distinguishes recorders for the thread-local buffer lookup, which an
+  // address could not once one recorder replaces another.
+  uint64_t id_;
+  clock::time_point origin_;
+  size_t max_events_;
+  std::atomic<size_t> recorded_{0};
+  std::atomic<uint64_t> dropped_{0};
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<ThreadBuffer>> threads_;
+};
@@ -2,6 +2,27 @@ add_requires("lzham_codec", "lz4", "lzma")
 set_languages("cxx23")
 add_rules("plugin.compile_commands.autoupdate", {outputdir = "build"})
 
+target("abcore")
+    set_kind("static")
+    add_files("src/*.cc|main.cc")
+    add_includedirs("src", {public = true})
+    add_packages("lzham_codec", "lz4", "lzma", {public = true})
+
 target("lzham-ab-decompressor")
-    add_files("src/*.cc")
-    add_packages("lzham_codec", "lz4", "lzma")
\ No newline at end of file
+    add_files("src/main.cc")
+    add_deps("abcore")
+    add_packages("lzham_codec", "lz4", "lzma")
+
+target("bench")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/bench.cc")
+    add_deps("abcore")
+    add_packages("lzham_codec", "lz4", "lzma")
+
+target("gen-bundle")
+    set_kind("binary")
+    set_default(false)
+    add_files("bench/gen_bundle.cc")
+    add_deps("abcore")
+    add_packages("lzham_codec", "lz4", "lzma")